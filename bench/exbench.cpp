@@ -0,0 +1,321 @@
+/*
+ * Host (Linux, glibc) microbenchmark of router, dispatch and request parsers.
+ *
+ * Build and run from repository root:
+ *   g++ -O2 -std=gnu++17 -Ibench/stubs -Isrc bench/exbench.cpp src/express.cpp src/exroute.cpp \
+ *       src/exparse.cpp src/exmultipart.cpp src/exdeflate.cpp -o exbench && ./exbench
+ *
+ * Reports ns/request and heap allocations/request for route tables of
+ * 10/100/1000 routes (trie vs. the old map + linear comparePath scan),
+ * for whole requests through Express::doRQ() (middleware, handler, response),
+ * for ExRequest parsing against a stubbed httpd_req_t (bench/stubs) and for
+ * the bare query/cookie/number parsers. Before measuring, it checks that router-wide
+ * middleware covers a mounted router's root page and 404s below it (exit code 1 on failure).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <map>
+#include <list>
+#include <string>
+#include <vector>
+#include "exroute.h"
+#include "exparse.h"
+#include "exkv.hpp"
+#include "express.h"
+
+/* Count heap allocations - malloc() itself, so operator new, strdup() and C code are included */
+static size_t g_allocs = 0;
+
+extern "C" {
+void *__libc_malloc(size_t n);
+void *__libc_calloc(size_t n, size_t s);
+void *__libc_realloc(void *p, size_t n);
+void __libc_free(void *p);
+
+void *malloc(size_t n) noexcept { g_allocs++; return __libc_malloc(n); }
+void *calloc(size_t n, size_t s) noexcept { g_allocs++; return __libc_calloc(n, s); }
+void *realloc(void *p, size_t n) noexcept { g_allocs++; return __libc_realloc(p, n); }
+void free(void *p) noexcept { __libc_free(p); }
+}
+
+/* Stub hooks (see bench/stubs/esp_stubs.h) */
+static const char *g_cookie = NULL;
+static const char *bench_hdr(const char *key) { return (strcasecmp(key, "Cookie") == 0) ? g_cookie : NULL; }
+const char *(*stub_hdr)(const char *key) = bench_hdr;
+size_t stub_sent = 0;
+
+static volatile uintptr_t g_sink;
+
+struct cmp_str {
+    bool operator()(const char *a, const char *b) const { return strcmp(a, b) < 0; }
+};
+
+/*!
+ * \brief Run fn for every uri until ~0.2 s elapsed, print ns and allocations per call.
+ */
+template <typename F>
+static void bench(const char *name, int routes, const std::vector<std::string> &uris, F fn)
+{
+    using clk = std::chrono::steady_clock;
+    size_t n = 0, a;
+    auto t0 = clk::now();
+    double ns;
+
+    a = g_allocs;
+    do {
+        for (const auto &u : uris) fn(u.c_str());
+        n += uris.size();
+    } while (std::chrono::duration<double>(clk::now() - t0).count() < 0.2);
+    ns = std::chrono::duration<double, std::nano>(clk::now() - t0).count();
+    printf("%-28s %6d %10.1f %10.2f\n", name, routes, ns / n, (double)(g_allocs - a) / n);
+}
+
+/*!
+ * \brief Synthetic route table (static pages, REST resources with parameters, wildcards).
+ */
+static void make_routes(int n, std::vector<std::string> &r)
+{
+    char buf[64];
+    for (int i = 0; (int)r.size() < n; ++i) {
+        switch (i % 5) {
+            case 0: snprintf(buf, sizeof(buf), "_next/static/chunks/%d.js", i); break;
+            case 1: snprintf(buf, sizeof(buf), "api/res%d", i); break;
+            case 2: snprintf(buf, sizeof(buf), "api/res%d/:id", i); break;
+            case 3: snprintf(buf, sizeof(buf), "api/res%d/:id/:val", i); break;
+            default: snprintf(buf, sizeof(buf), "files/dir%d/*", i); break;
+        }
+        r.push_back(buf);
+    }
+}
+
+static void make_uris(int n, std::vector<std::string> &u)
+{
+    char buf[64];
+    for (int i = 0; i < n; i += (n / 10) + 1) {
+        switch (i % 5) {
+            case 0: snprintf(buf, sizeof(buf), "_next/static/chunks/%d.js", i); break;
+            case 1: snprintf(buf, sizeof(buf), "api/res%d", i); break;
+            case 2: snprintf(buf, sizeof(buf), "api/res%d/42", i); break;
+            case 3: snprintf(buf, sizeof(buf), "api/res%d/7/0x10", i); break;
+            default: snprintf(buf, sizeof(buf), "files/dir%d/readme.txt", i); break;
+        }
+        u.push_back(buf);
+    }
+    u.push_back("api/missing/page");
+    u.push_back("index.html");
+}
+
+static void bench_router(int n)
+{
+    std::vector<std::string> paths, uris;
+    ExRouteTable t;
+    std::map<const char*, int, cmp_str> st;
+    std::list<std::pair<const char*, int> > meta;
+
+    make_routes(n, paths);
+    make_uris(n, uris);
+    for (size_t i = 0; i < paths.size(); ++i) {
+        const char *p = paths[i].c_str();
+        t.add(p);
+        if (ExRouteTable::hasMeta(p)) meta.push_back({ p, (int)i }); else st.insert({ p, (int)i });
+    }
+    bench("route: trie match", n, uris, [&](const char *u) {
+        ExRouteMatch m;
+        g_sink += t.match(u, 1, &m);
+    });
+    bench("route: map + comparePath", n, uris, [&](const char *u) {
+        int r = -1;
+        auto i = st.find(u);
+        if (i != st.end()) r = i->second;
+        else for (const auto &x : meta) if (ExRouteTable::comparePath(x.first, u)) { r = x.second; break; }
+        g_sink += r;
+    });
+}
+
+/*!
+ * \brief Keep-alive connections (one httpd request per uri, session context kept between requests).
+ */
+struct BenchConns {
+    BenchConns(const std::vector<std::string> &uris, int method = HTTP_GET) : n(uris.size()) {
+        rq = (httpd_req_t *)calloc(n, sizeof(httpd_req_t));
+        for (size_t i = 0; i < n; ++i) {
+            snprintf((char *)rq[i].uri, sizeof(rq[i].uri), "/%s", uris[i].c_str());
+            rq[i].method = method;
+        }
+    }
+    ~BenchConns() {
+        for (size_t i = 0; i < n; ++i) if (rq[i].free_ctx) rq[i].free_ctx(rq[i].sess_ctx);
+        free(rq);
+    }
+    /* Next request (bench() walks uris in order) */
+    httpd_req_t *next() { httpd_req_t *r = &rq[k]; if (++k == n) k = 0; return r; }
+
+    httpd_req_t *rq;
+    size_t n, k = 0;
+};
+
+static void bench_dispatch(int n)
+{
+    std::vector<std::string> paths, uris;
+    Express e;
+
+    make_routes(n, paths);
+    make_uris(n, uris);
+    e.use("api", [](ExRequest *req) { g_sink += req->uriLen(); return true; });
+    for (const auto &p : paths) {
+        e.get(p.c_str(), [](ExRequest *req) {
+            g_sink += req->getParamInt("id", 0);
+            req->txt("ok", 2);
+        });
+    }
+    e.freeze();
+    BenchConns c(uris);
+    bench("dispatch: doRQ", n, uris, [&](const char *) {
+        g_sink += e.doRQ(c.next());
+    });
+}
+
+static void bench_request()
+{
+    std::vector<std::string> urls = {
+        "index.html",
+        "api/res1?nr=0&val=3",
+        "api/data?from=1700000000&to=1700086400&step=60&fmt=json",
+        "api/search?q=hello+world&path=%2Fdata%2Flogs&tag=a%20b",
+    };
+    std::vector<std::string> items = { "api/item/42/7", "api/item/-17/0x10", "api/item/65535/3" };
+    Express e;
+    ExArena a;
+
+    e.get("api/item/:id/:val", [](ExRequest *req) {
+        g_sink += req->getParamInt("id") + req->getParamInt("val");
+        req->txt("ok", 2);
+    });
+    e.freeze();
+    BenchConns cu(urls), ci(items);
+    /* ExRequest on stubbed httpd request (arena reset as in doRQ) */
+    bench("request: parseURI", 0, urls, [&](const char *) {
+        a.reset();
+        ExRequest r(cu.next(), &e, &a);
+        g_sink += r.uriLen();
+    });
+    bench("request: getArg", 0, urls, [&](const char *) {
+        a.reset();
+        ExRequest r(cu.next(), &e, &a);
+        g_sink += (uintptr_t)r.getArg("val");
+    });
+    /* Same Cookie header on a connection - decoded table is reused */
+    g_cookie = "sessionid=2c5ea4c0-4067-11e9-8bad-9b1deb4d3b7d; theme=dark; lang=en; _ga=GA1.2.1234567890.1700000000";
+    bench("request: getCookie", 0, urls, [&](const char *) {
+        a.reset();
+        ExRequest r(cu.next(), &e, &a);
+        g_sink += (uintptr_t)r.getCookie("sessionid");
+    });
+    g_cookie = NULL;
+    bench("request: getParamInt (doRQ)", 0, items, [&](const char *) {
+        g_sink += e.doRQ(ci.next());
+    });
+}
+
+static void bench_parsers()
+{
+    std::vector<std::string> urls = {
+        "/index.html",
+        "/api/res1?nr=0&val=3",
+        "/api/data?from=1700000000&to=1700086400&step=60&fmt=json",
+        "/api/search?q=hello+world&path=%2Fdata%2Flogs&tag=a%20b",
+    };
+    std::vector<std::string> cookies = {
+        "sessionid=2c5ea4c0-4067-11e9-8bad-9b1deb4d3b7d",
+        "sessionid=2c5ea4c0-4067-11e9-8bad-9b1deb4d3b7d; theme=dark; lang=en; _ga=GA1.2.1234567890.1700000000",
+    };
+    auto ins = [](void *ctx, const char *k, const char *v, const char *raw, size_t raw_len) { ((ExKVTable<> *)ctx)->add(k, v, raw, raw_len); };
+    ExArena a;
+
+    /* Same steps as ExRequest (arena reset, split path view, decode query into arena) */
+    bench("parse: uri + query", 0, urls, [&](const char *u) {
+        a.reset();
+        ExKVTable<> m(&a);
+        const char *q = strchr(u, '?');
+        if (q) {
+            size_t l = strlen(++q);
+            express_parse_query(q, (char *)a.alloc(l + 1, 1), l, ins, &m);
+        }
+        g_sink += (uintptr_t)m.find("val");
+    });
+    bench("parse: cookie", 0, cookies, [&](const char *c) {
+        a.reset();
+        ExKVTable<> m(&a);
+        size_t l = strlen(c);
+        express_parse_cookie(c, (char *)a.alloc(l + 1, 1), l, ins, &m);
+        g_sink += (uintptr_t)m.find("sessionid");
+    });
+    bench("parse: int", 0, { "42", "-17", "0x1F", "65535" }, [&](const char *s) {
+        int v = 0;
+        express_parse_int(s, strlen(s), &v);
+        g_sink += v;
+    });
+    bench("parse: int (sscanf)", 0, { "42", "-17", "0x1F", "65535" }, [&](const char *s) {
+        int v = 0;
+        if (sscanf(s, "0x%x", &v) != 1) sscanf(s, "%d", &v);
+        g_sink += v;
+    });
+    bench("parse: float", 0, { "3.25", "-0.5", "1e3", "12.75" }, [&](const char *s) {
+        double v = 0;
+        express_parse_double(s, strlen(s), &v);
+        g_sink += (size_t)v;
+    });
+}
+
+/*!
+ * \brief Sanity check of dispatch: router-wide middleware runs for the router root page and 404s below it.
+ */
+static bool check_router_scope()
+{
+    static int calls;
+    Express e;
+    ExRouter r;
+    struct { const char *uri; int calls; } t[] = {
+        { "/api/v2", 1 }, { "/api/v2/", 1 }, { "/api/v2/status", 1 }, { "/api/v2/missing", 1 }, { "/api/v2x", 0 }, { "/other", 0 }
+    };
+    bool ok = true;
+
+    r.use("", [](ExRequest *) { calls++; return true; });
+    r.get("", [](ExRequest *req) { req->txt("root", 4); });
+    r.get("status", [](ExRequest *req) { req->txt("ok", 2); });
+    e.mount("api/v2", r);
+    e.freeze();
+    for (const auto &x : t) {
+        httpd_req_t *q = (httpd_req_t *)calloc(1, sizeof(httpd_req_t));
+        snprintf((char *)q->uri, sizeof(q->uri), "%s", x.uri);
+        q->method = HTTP_GET;
+        calls = 0;
+        e.doRQ(q);
+        if (calls != x.calls) {
+            printf("FAIL: %s - router middleware called %d times, expected %d\n", x.uri, calls, x.calls);
+            ok = false;
+        }
+        if (q->free_ctx) q->free_ctx(q->sess_ctx);
+        free(q);
+    }
+    return ok;
+}
+
+int main()
+{
+    if (!check_router_scope()) return 1;
+    printf("%-28s %6s %10s %10s\n", "benchmark", "routes", "ns/req", "allocs/req");
+    for (int n : { 10, 100, 1000 }) bench_router(n);
+    for (int n : { 10, 100, 1000 }) bench_dispatch(n);
+    bench_request();
+    bench_parsers();
+    return 0;
+}
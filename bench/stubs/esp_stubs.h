@@ -0,0 +1,199 @@
+/*
+ * Minimal ESP-IDF stand-ins for the host benchmark (bench/exbench.cpp).
+ *
+ * Only what src/express.cpp needs to compile and run a request through
+ * Express::doRQ(): httpd_send() counts bytes, request headers come from
+ * the stub_hdr hook, request bodies are empty. Not a device emulation.
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef ESP_STUBS_H
+#define ESP_STUBS_H
+
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+/* Bench hooks (defined in exbench.cpp) */
+extern const char *(*stub_hdr)(const char *key);  /* request header value (NULL = missing) */
+extern size_t stub_sent;                          /* bytes passed to httpd_send()         */
+
+/* esp_err.h */
+typedef int esp_err_t;
+#define ESP_OK                 0
+#define ESP_FAIL              -1
+#define ESP_ERR_NO_MEM         0x101
+#define ESP_ERR_INVALID_ARG    0x102
+#define ESP_ERR_INVALID_STATE  0x103
+#define ESP_ERR_NOT_FOUND      0x105
+
+/* FreeRTOS */
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t TickType_t;
+typedef void *SemaphoreHandle_t;
+typedef void *TaskHandle_t;
+#define tskNO_AFFINITY      0x7fffffff
+#define portTICK_PERIOD_MS  1
+#define portNUM_PROCESSORS  2
+#define pdFALSE             0
+#define pdTRUE              1
+#define vSemaphoreCreateBinary(x) (x) = 0
+static inline void vSemaphoreDelete(void *) {}
+static inline int xSemaphoreTake(void *, TickType_t) { return 1; }
+static inline int xSemaphoreGive(void *) { return 1; }
+static inline void vTaskDelay(int) {}
+static inline UBaseType_t uxTaskGetNumberOfTasks() { return 1; }
+static inline void vTaskList(char *s) { *s = '\0'; }
+static inline int xPortGetCoreID() { return 0; }
+
+/* esp_system.h, esp_timer.h, esp_random.h */
+static inline void esp_restart() {}
+static inline uint32_t esp_get_free_heap_size() { return 0; }
+static inline int esp_reset_reason() { return 0; }
+static inline uint32_t esp_random() { return 0; }
+static inline int64_t esp_timer_get_time() { return 0; }
+
+/* esp_log.h */
+typedef int (*vprintf_like_t)(const char *, va_list);
+static inline vprintf_like_t esp_log_set_vprintf(vprintf_like_t f) { return f; }
+#define ESP_LOGI(tag, fmt, ...) do {} while (0)
+#define ESP_LOGW(tag, fmt, ...) do {} while (0)
+#define ESP_LOGE(tag, fmt, ...) do {} while (0)
+
+/* esp_pm.h, esp_partition.h, esp_ota_ops.h */
+typedef void *esp_pm_lock_handle_t;
+typedef struct { int unused; } esp_partition_t;
+typedef uint32_t esp_ota_handle_t;
+#define OTA_WITH_SEQUENTIAL_WRITES 0
+static inline const esp_partition_t *esp_ota_get_next_update_partition(void *) { return NULL; }
+static inline esp_err_t esp_ota_begin(const esp_partition_t *, size_t, esp_ota_handle_t *) { return ESP_FAIL; }
+static inline esp_err_t esp_ota_write(esp_ota_handle_t, const void *, size_t) { return ESP_FAIL; }
+static inline esp_err_t esp_ota_end(esp_ota_handle_t) { return ESP_FAIL; }
+static inline esp_err_t esp_ota_abort(esp_ota_handle_t) { return ESP_OK; }
+static inline esp_err_t esp_ota_set_boot_partition(const esp_partition_t *) { return ESP_FAIL; }
+
+/* mbedtls/base64.h */
+static inline int mbedtls_base64_encode(unsigned char *, size_t, size_t *, const unsigned char *, size_t) { return -1; }
+
+/* lwIP */
+#define CONFIG_LWIP_MAX_LISTENING_TCP 8
+
+/* esp_http_server.h */
+typedef void *httpd_handle_t;
+typedef int httpd_method_t;
+enum { HTTP_DELETE = 0, HTTP_GET = 1, HTTP_HEAD = 2, HTTP_POST = 3, HTTP_PUT = 4, HTTP_OPTIONS = 6, HTTP_PATCH = 28 };
+#define HTTP_ANY -1
+#define HTTPD_MAX_URI_LEN 512
+#define HTTPD_SOCK_ERR_FAIL     -1
+#define HTTPD_SOCK_ERR_INVALID  -2
+#define HTTPD_SOCK_ERR_TIMEOUT  -3
+typedef void (*httpd_free_ctx_fn_t)(void *);
+typedef bool (*httpd_uri_match_func_t)(const char *, const char *, size_t);
+
+typedef struct httpd_req {
+    httpd_handle_t handle;
+    int            method;
+    const char     uri[HTTPD_MAX_URI_LEN + 1];
+    size_t         content_len;
+    void          *aux;
+    void          *user_ctx;
+    void          *sess_ctx;
+    httpd_free_ctx_fn_t free_ctx;
+    bool           ignore_sess_ctx_changes;
+} httpd_req_t;
+
+typedef struct {
+    const char     *uri;
+    httpd_method_t  method;
+    esp_err_t     (*handler)(httpd_req_t *);
+    void           *user_ctx;
+    bool            is_websocket;
+    bool            handle_ws_control_frames;
+    const char     *supported_subprotocol;
+} httpd_uri_t;
+
+typedef struct {
+    unsigned    task_priority;
+    size_t      stack_size;
+    BaseType_t  core_id;
+    uint16_t    server_port;
+    uint16_t    ctrl_port;
+    uint16_t    max_open_sockets;
+    uint16_t    max_uri_handlers;
+    uint16_t    max_resp_headers;
+    uint16_t    backlog_conn;
+    bool        lru_purge_enable;
+    uint16_t    recv_wait_timeout;
+    uint16_t    send_wait_timeout;
+    void       *global_user_ctx;
+    httpd_free_ctx_fn_t global_user_ctx_free_fn;
+    httpd_uri_match_func_t uri_match_fn;
+} httpd_config_t;
+#define HTTPD_DEFAULT_CONFIG() httpd_config_t{}
+
+typedef enum {
+    HTTPD_400_BAD_REQUEST, HTTPD_404_NOT_FOUND, HTTPD_405_METHOD_NOT_ALLOWED,
+    HTTPD_413_CONTENT_TOO_LARGE = 8, HTTPD_500_INTERNAL_SERVER_ERROR
+} httpd_err_code_t;
+
+static inline bool httpd_uri_match_wildcard(const char *, const char *, size_t) { return true; }
+static inline esp_err_t httpd_start(httpd_handle_t *, const httpd_config_t *) { return ESP_OK; }
+static inline esp_err_t httpd_register_uri_handler(httpd_handle_t, const httpd_uri_t *) { return ESP_OK; }
+static inline void *httpd_get_global_user_ctx(httpd_handle_t) { return NULL; }
+static inline size_t httpd_req_get_hdr_value_len(httpd_req_t *, const char *k)
+{
+    const char *v = stub_hdr ? stub_hdr(k) : NULL;
+    return v ? strlen(v) : 0;
+}
+static inline esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *, const char *k, char *b, size_t n)
+{
+    const char *v = stub_hdr ? stub_hdr(k) : NULL;
+    if (!v) return ESP_ERR_NOT_FOUND;
+    strncpy(b, v, n);
+    b[n - 1] = '\0';
+    return ESP_OK;
+}
+static inline size_t httpd_req_get_url_query_len(httpd_req_t *) { return 0; }
+static inline int httpd_req_recv(httpd_req_t *, char *, size_t) { return 0; }
+static inline int httpd_send(httpd_req_t *, const char *, size_t l) { stub_sent += l; return (int)l; }
+static inline esp_err_t httpd_resp_set_status(httpd_req_t *, const char *) { return ESP_OK; }
+static inline esp_err_t httpd_resp_set_type(httpd_req_t *, const char *) { return ESP_OK; }
+static inline esp_err_t httpd_resp_set_hdr(httpd_req_t *, const char *, const char *) { return ESP_OK; }
+static inline esp_err_t httpd_resp_send(httpd_req_t *, const char *, ssize_t l) { stub_sent += (l < 0) ? 0 : l; return ESP_OK; }
+static inline esp_err_t httpd_resp_send_chunk(httpd_req_t *, const char *, ssize_t l) { stub_sent += (l < 0) ? 0 : l; return ESP_OK; }
+static inline esp_err_t httpd_resp_send_500(httpd_req_t *) { return ESP_OK; }
+static inline esp_err_t httpd_resp_send_err(httpd_req_t *, httpd_err_code_t, const char *) { return ESP_OK; }
+static inline int httpd_req_to_sockfd(httpd_req_t *) { return 0; }
+static inline void *httpd_sess_get_ctx(httpd_handle_t, int) { return NULL; }
+static inline void httpd_sess_set_ctx(httpd_handle_t, int, void *, httpd_free_ctx_fn_t) {}
+static inline esp_err_t httpd_sess_trigger_close(httpd_handle_t, int) { return ESP_OK; }
+typedef void (*httpd_work_fn_t)(void *);
+static inline esp_err_t httpd_queue_work(httpd_handle_t, httpd_work_fn_t, void *) { return ESP_OK; }
+static inline esp_err_t httpd_get_client_list(httpd_handle_t, size_t *n, int *) { *n = 0; return ESP_OK; }
+
+/* Websocket */
+typedef enum { HTTPD_WS_TYPE_CONTINUE = 0, HTTPD_WS_TYPE_TEXT = 1, HTTPD_WS_TYPE_BINARY = 2 } httpd_ws_type_t;
+typedef enum { HTTPD_WS_CLIENT_INVALID, HTTPD_WS_CLIENT_HTTP, HTTPD_WS_CLIENT_WEBSOCKET } httpd_ws_client_info_t;
+typedef struct {
+    bool            final;
+    bool            fragmented;
+    httpd_ws_type_t type;
+    uint8_t        *payload;
+    size_t          len;
+} httpd_ws_frame_t;
+static inline esp_err_t httpd_ws_recv_frame(httpd_req_t *, httpd_ws_frame_t *, size_t) { return ESP_FAIL; }
+static inline esp_err_t httpd_ws_send_frame(httpd_req_t *, httpd_ws_frame_t *) { return ESP_OK; }
+static inline esp_err_t httpd_ws_send_frame_async(httpd_handle_t, int, httpd_ws_frame_t *) { return ESP_OK; }
+static inline httpd_ws_client_info_t httpd_ws_get_fd_info(httpd_handle_t, int) { return HTTPD_WS_CLIENT_HTTP; }
+
+#endif /* ESP_STUBS_H */
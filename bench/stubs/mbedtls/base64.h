@@ -0,0 +1,2 @@
+/* Host benchmark stand-in (see esp_stubs.h) */
+#include "../esp_stubs.h"
@@ -49,13 +49,14 @@ bool sessionMiddleware(ExRequest* req) {
 		if (strcmp(req->uri(),"index.html")) return true;
 			/* Generate new session ID */
 			std::string uuid = req->m_e->generateUUID();
-			req->m_user["sessionid"] = uuid;
-			req->m_user["cookie"] = "SessionID=" + uuid + "; Max-Age=2592000";
-			req->setCookie(req->m_user["cookie"].c_str());
+			std::string cookie = "SessionID=" + uuid + "; Max-Age=2592000";
+			req->ctx<ExSessionId>() = req->m_arena->strdup(uuid.c_str());
+			req->ctx<ExSessionCookie>() = req->m_arena->strdup(cookie.c_str());
+			req->setCookie(req->ctx<ExSessionCookie>());
 			msg_debug("Generate new session ID: %s", uuid.c_str());
 		} else {
 			msg_debug("Got session ID: %s",sessionID);
-			req->m_user["sessionid"] = std::string(sessionID);
+			req->ctx<ExSessionId>() = sessionID;
 		}
 	return true;
 }
@@ -74,7 +75,8 @@ void SETUP_task(void *parameter)
 	});
 
 	e.get("api/log", [](ExRequest* req) {
-		req->txt(RAMLog::instance()->read().c_str());
+		ExResponseStream s(req);
+		RAMLog::instance()->read(s);
 	});
 
 	e.addStatic(www_filesystem);
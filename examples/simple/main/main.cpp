@@ -48,7 +48,8 @@ void SETUP_task(void *parameter)
 		req->json("{\"ip\": \"192.168.124.227\", \"netmask\": \"255.255.255.0\", \"gateway\": \"\", \"dhcp\": \"STATIC\", \"ntp\": \"NONTP\", \"ntps\": \"\" }");
 	});
 	e.get("api/log", [](ExRequest* req) {
-		req->txt(RAMLog::instance()->read().c_str());
+		ExResponseStream s(req);
+		RAMLog::instance()->read(s);
 	});
 
 
@@ -0,0 +1,116 @@
+/*
+ * Per request bump allocator (needs C++11).
+ * Implementation details:
+ *   - One block allocated once and reused by every request (reset is O(1)),
+ *   - Requests not fitting in the block take extra heap blocks released on reset,
+ *   - free is a no-op, memory is returned all at once by reset.
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef EXARENA_HPP
+#define EXARENA_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Arena block size in bytes (uri, cookie string and request tables) */
+#ifndef EXPRESS_ARENA_SIZE
+#define EXPRESS_ARENA_SIZE (1536)
+#endif
+
+class ExArena {
+	struct Block {
+		Block *next;
+	};
+public:
+	ExArena(size_t size = EXPRESS_ARENA_SIZE) : m_size(size), m_base(NULL), m_ptr(NULL), m_end(NULL), m_extra(NULL) {}
+	~ExArena() { reset(); ::free(m_base); }
+
+	/*!
+	 * \brief Allocate n bytes (NULL when out of memory).
+	 */
+	void *alloc(size_t n, size_t align = sizeof(void *)) {
+		char *p = (char *)(((uintptr_t)m_ptr + (align - 1)) & ~(uintptr_t)(align - 1));
+		if ((m_ptr) && (p + n <= m_end)) {
+			m_ptr = p + n;
+			return p;
+		}
+		return grow(n, align);
+	}
+
+	/*!
+	 * \brief Copy string (or first n characters) into the arena.
+	 */
+	char *strndup(const char *s, size_t n) {
+		char *d = (char *)alloc(n + 1, 1);
+		if (d) { memcpy(d, s, n); d[n] = '\0'; }
+		return d;
+	}
+	char *strdup(const char *s) { return strndup(s, strlen(s)); }
+
+	/*!
+	 * \brief Release everything allocated since last reset.
+	 */
+	void reset() {
+		while (m_extra) {
+			Block *b = m_extra;
+			m_extra = b->next;
+			::free(b);
+		}
+		m_ptr = m_base;
+	}
+
+private:
+	void *grow(size_t n, size_t align) {
+		/* First use - allocate main block */
+		if ((!m_base) && (n + align <= m_size)) {
+			m_base = (char *)::malloc(m_size);
+			if (m_base) {
+				m_ptr = m_base;
+				m_end = m_base + m_size;
+				return alloc(n, align);
+			}
+		}
+		/* Does not fit - separate heap block (released on reset) */
+		Block *b = (Block *)::malloc(sizeof(Block) + n + align);
+		if (!b) return NULL;
+		b->next = m_extra;
+		m_extra = b;
+		return (void *)(((uintptr_t)(b + 1) + (align - 1)) & ~(uintptr_t)(align - 1));
+	}
+
+	size_t m_size;
+	char  *m_base, *m_ptr, *m_end;
+	Block *m_extra;
+};
+
+/*!
+ * \brief STL allocator using ExArena (deallocate is a no-op).
+ */
+template <typename T>
+struct ExArenaAllocator {
+	typedef T value_type;
+
+	ExArenaAllocator(ExArena *a) : m_arena(a) {}
+	template <typename U> ExArenaAllocator(const ExArenaAllocator<U> &o) : m_arena(o.m_arena) {}
+
+	T *allocate(size_t n) {
+		void *p = m_arena->alloc(n * sizeof(T), alignof(T));
+		if (!p) abort();
+		return (T *)p;
+	}
+	void deallocate(T *, size_t) {}
+
+	template <typename U> bool operator == (const ExArenaAllocator<U> &o) const { return m_arena == o.m_arena; }
+	template <typename U> bool operator != (const ExArenaAllocator<U> &o) const { return m_arena != o.m_arena; }
+
+	ExArena *m_arena;
+};
+
+#endif // EXARENA_HPP
@@ -0,0 +1,113 @@
+/*
+ * Typed per request context (needs C++11).
+ *
+ *   struct SessionId { typedef const char *type; };
+ *   req->ctx<SessionId>() = "abc";
+ *   const char **sid = req->findCtx<SessionId>();
+ *
+ * Implementation details:
+ *   - Key is a type (address of a per type static is the slot id, no strings),
+ *   - First N slots are stored inline, more slots spill to the request arena,
+ *   - Values live in the request arena, destructors run with the request.
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef EXCTX_HPP
+#define EXCTX_HPP
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <type_traits>
+#include <exarena.hpp>
+
+/* Number of context slots stored inline */
+#ifndef EXPRESS_CTX_SLOTS
+#define EXPRESS_CTX_SLOTS (4)
+#endif
+
+/*!
+ * \brief Unique id for context key type.
+ */
+template <typename K>
+struct ExCtxId {
+	static const char id;
+};
+template <typename K> const char ExCtxId<K>::id = 0;
+
+struct ExCtxSlot {
+	const void *key;
+	void       *val;
+	void      (*destroy)(void *);
+};
+
+template <size_t N = EXPRESS_CTX_SLOTS>
+class ExCtx {
+public:
+	ExCtx(ExArena *a) : m_arena(a), m_data(m_inline), m_count(0), m_cap(N) {}
+	~ExCtx() { clear(); }
+	ExCtx(const ExCtx &) = delete;
+	ExCtx &operator = (const ExCtx &) = delete;
+
+	/*!
+	 * \brief Find value (NULL when not set).
+	 */
+	template <typename K>
+	typename K::type *find() const {
+		for (size_t i = 0; i < m_count; ++i) {
+			if (m_data[i].key == &ExCtxId<K>::id) return (typename K::type *)m_data[i].val;
+		}
+		return NULL;
+	}
+
+	/*!
+	 * \brief Get value (value initialized on first use).
+	 */
+	template <typename K>
+	typename K::type &get() {
+		typedef typename K::type T;
+		T *v = find<K>();
+		if (v) return *v;
+		if ((m_count == m_cap) && (!grow())) abort();
+		v = (T *)m_arena->alloc(sizeof(T), alignof(T));
+		if (!v) abort();
+		new (v) T();
+		m_data[m_count++] = { &ExCtxId<K>::id, v, std::is_trivially_destructible<T>::value ? NULL : &destroy<T> };
+		return *v;
+	}
+
+	/*!
+	 * \brief Run destructors (memory is released by arena reset).
+	 */
+	void clear() {
+		for (size_t i = m_count; i > 0; --i) {
+			if (m_data[i - 1].destroy) m_data[i - 1].destroy(m_data[i - 1].val);
+		}
+		m_data = m_inline; m_count = 0; m_cap = N;
+	}
+
+private:
+	template <typename T>
+	static void destroy(void *p) { ((T *)p)->~T(); }
+
+	bool grow() {
+		ExCtxSlot *d = (ExCtxSlot *)m_arena->alloc(2 * m_cap * sizeof(ExCtxSlot), alignof(ExCtxSlot));
+		if (!d) return false;
+		memcpy(d, m_data, m_count * sizeof(ExCtxSlot));
+		m_data = d;
+		m_cap *= 2;
+		return true;
+	}
+
+	ExArena   *m_arena;
+	ExCtxSlot *m_data;
+	size_t     m_count, m_cap;
+	ExCtxSlot  m_inline[N];
+};
+
+#endif // EXCTX_HPP
@@ -0,0 +1,241 @@
+/*
+ * Streaming gzip compressor (LZ77 + fixed Huffman deflate).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "exdeflate.h"
+
+#define EXDEFLATE_W         (EXPRESS_GZIP_WINDOW)
+#define EXDEFLATE_HASH      (EXPRESS_GZIP_WINDOW / 2)
+#define EXDEFLATE_MIN       (3)
+#define EXDEFLATE_MAX       (258)
+/* Farthest match - history kept after slide() (see zlib MAX_DIST) */
+#define EXDEFLATE_MAX_DIST  (EXDEFLATE_W - EXDEFLATE_MAX - 1)
+
+static_assert((EXDEFLATE_W & (EXDEFLATE_W - 1)) == 0, "EXPRESS_GZIP_WINDOW must be a power of 2");
+/* Positions + 1 are kept in 16 bits */
+static_assert((EXDEFLATE_W >= 1024) && (EXDEFLATE_W <= 16384), "EXPRESS_GZIP_WINDOW: 1024 .. 16384");
+
+/* RFC 1951 length and distance codes */
+static const uint16_t exdeflate_len_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t exdeflate_len_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t exdeflate_dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+    4097, 6145, 8193, 12289, 16385, 24577 };
+static const uint8_t exdeflate_dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+/*!
+ * \brief CRC32 (gzip, IEEE 802.3), crc = 0 for first block.
+ */
+uint32_t express_crc32(uint32_t crc, const void *data, size_t len)
+{
+    /* Nibble table - 64 bytes instead of 1 KB */
+    static const uint32_t t[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+        0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c };
+    const uint8_t *p = (const uint8_t *)data;
+
+    crc = ~crc;
+    while (len--) {
+        crc ^= *p++;
+        crc = (crc >> 4) ^ t[crc & 15];
+        crc = (crc >> 4) ^ t[crc & 15];
+    }
+    return ~crc;
+}
+
+/*!
+ * \brief Reverse n bits (Huffman codes are sent MSB first).
+ */
+static inline uint32_t exdeflate_rev(uint32_t v, int n)
+{
+    uint32_t r = 0;
+    while (n--) { r = (r << 1) | (v & 1); v >>= 1; }
+    return r;
+}
+
+ExDeflate::ExDeflate(ExDeflateOut out, void *ctx)
+{
+    static const uint8_t gz[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };
+
+    m_out = out;
+    m_ctx = ctx;
+    m_pos = m_end = 0;
+    m_bitbuf = 0;
+    m_nbits = 0;
+    m_crc = m_isize = m_osize = 0;
+    m_done = false;
+    m_olen = 0;
+    m_win = (uint8_t *)malloc(2 * EXDEFLATE_W + (EXDEFLATE_HASH + EXDEFLATE_W) * sizeof(uint16_t));
+    if (!m_win) return;
+    m_head = (uint16_t *)(m_win + 2 * EXDEFLATE_W);
+    m_prev = m_head + EXDEFLATE_HASH;
+    memset(m_head, 0, EXDEFLATE_HASH * sizeof(uint16_t));
+    /* gzip header (no name, no time), then one final fixed Huffman block */
+    for (size_t i = 0; i < sizeof(gz); ++i) put(gz[i]);
+    bits(1, 1);
+    bits(1, 2);
+}
+
+ExDeflate::~ExDeflate()
+{
+    free(m_win);
+}
+
+void ExDeflate::write(const char *d, size_t len)
+{
+    if ((!m_win) || (m_done)) return;
+    m_crc = express_crc32(m_crc, d, len);
+    m_isize += len;
+    while (len) {
+        size_t n;
+        if (m_end == 2 * EXDEFLATE_W) slide();
+        n = 2 * EXDEFLATE_W - m_end;
+        if (n > len) n = len;
+        memcpy(m_win + m_end, d, n);
+        m_end += n;
+        d += n;
+        len -= n;
+        compress(false);
+    }
+}
+
+void ExDeflate::finish()
+{
+    if ((!m_win) || (m_done)) return;
+    compress(true);
+    /* End of block (code 256 = 7 zero bits), byte align, CRC32 and size (LE) */
+    bits(0, 7);
+    if (m_nbits) bits(0, 8 - m_nbits);
+    for (int i = 0; i < 32; i += 8) put((uint8_t)(m_crc >> i));
+    for (int i = 0; i < 32; i += 8) put((uint8_t)(m_isize >> i));
+    flush();
+    m_done = true;
+}
+
+/*!
+ * \brief Move upper half of window down (positions in tables are moved too).
+ */
+void ExDeflate::slide()
+{
+    memcpy(m_win, m_win + EXDEFLATE_W, EXDEFLATE_W);
+    m_pos -= EXDEFLATE_W;
+    m_end -= EXDEFLATE_W;
+    for (size_t i = 0; i < EXDEFLATE_HASH; ++i) m_head[i] = (m_head[i] > EXDEFLATE_W) ? m_head[i] - EXDEFLATE_W : 0;
+    for (size_t i = 0; i < EXDEFLATE_W; ++i) m_prev[i] = (m_prev[i] > EXDEFLATE_W) ? m_prev[i] - EXDEFLATE_W : 0;
+}
+
+static inline size_t exdeflate_hash(const uint8_t *p)
+{
+    return ((((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2]) * 2654435761u >> 16) & (EXDEFLATE_HASH - 1);
+}
+
+void ExDeflate::insert(size_t p)
+{
+    size_t h = exdeflate_hash(m_win + p);
+    m_prev[p & (EXDEFLATE_W - 1)] = m_head[h];
+    m_head[h] = (uint16_t)(p + 1);
+}
+
+/*!
+ * \brief Longest match for m_pos (0 when shorter than 3).
+ */
+size_t ExDeflate::match(size_t *dist)
+{
+    const uint8_t *s = m_win + m_pos;
+    size_t max = m_end - m_pos, best = 0;
+    size_t c = m_head[exdeflate_hash(s)];
+    int chain = EXPRESS_GZIP_CHAIN;
+
+    if (max > EXDEFLATE_MAX) max = EXDEFLATE_MAX;
+    while ((c) && (chain--)) {
+        const uint8_t *m = m_win + (--c);
+        size_t l = 0, n;
+        if (m_pos - c > EXDEFLATE_MAX_DIST) break;
+        if ((m[best] == s[best]) && (m[0] == s[0])) {
+            while ((l < max) && (m[l] == s[l])) l++;
+            if (l > best) {
+                best = l;
+                *dist = m_pos - c;
+                if (l == max) break;
+            }
+        }
+        n = m_prev[c & (EXDEFLATE_W - 1)];
+        /* Slot reused by a newer position - chain ends here */
+        if (n > c) break;
+        c = n;
+    }
+    return (best >= EXDEFLATE_MIN) ? best : 0;
+}
+
+void ExDeflate::compress(bool last)
+{
+    /* Keep max match lookahead until the end of input */
+    while ((m_end - m_pos > EXDEFLATE_MAX) || ((last) && (m_pos < m_end))) {
+        size_t len = 0, dist = 0;
+        if (m_end - m_pos >= EXDEFLATE_MIN) {
+            len = match(&dist);
+            insert(m_pos);
+        }
+        if (len) {
+            copy(len, dist);
+            for (size_t i = 1; i < len; ++i) {
+                if (m_end - (m_pos + i) >= EXDEFLATE_MIN) insert(m_pos + i);
+            }
+            m_pos += len;
+        } else {
+            literal(m_win[m_pos++]);
+        }
+    }
+}
+
+void ExDeflate::literal(uint8_t c)
+{
+    /* Fixed codes: 0..143 = 8 bits from 0x30, 144..255 = 9 bits from 0x190 */
+    if (c < 144) bits(exdeflate_rev(0x30 + c, 8), 8);
+    else bits(exdeflate_rev(0x190 + c - 144, 9), 9);
+}
+
+void ExDeflate::copy(size_t len, size_t dist)
+{
+    int i = 28, j = 29;
+    int sym;
+
+    while (exdeflate_len_base[i] > len) i--;
+    sym = 257 + i;
+    /* Fixed codes: 256..279 = 7 bits from 0, 280..287 = 8 bits from 0xc0 */
+    if (sym < 280) bits(exdeflate_rev(sym - 256, 7), 7);
+    else bits(exdeflate_rev(0xc0 + sym - 280, 8), 8);
+    if (exdeflate_len_extra[i]) bits(len - exdeflate_len_base[i], exdeflate_len_extra[i]);
+    while (exdeflate_dist_base[j] > dist) j--;
+    bits(exdeflate_rev(j, 5), 5);
+    if (exdeflate_dist_extra[j]) bits(dist - exdeflate_dist_base[j], exdeflate_dist_extra[j]);
+}
+
+void ExDeflate::bits(uint32_t v, int n)
+{
+    m_bitbuf |= v << m_nbits;
+    m_nbits += n;
+    while (m_nbits >= 8) {
+        put((uint8_t)m_bitbuf);
+        m_bitbuf >>= 8;
+        m_nbits -= 8;
+    }
+}
+
+void ExDeflate::flush()
+{
+    if (!m_olen) return;
+    m_osize += m_olen;
+    m_out(m_ctx, (const char *)m_obuf, m_olen);
+    m_olen = 0;
+}
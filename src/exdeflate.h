@@ -0,0 +1,91 @@
+/*
+ * Streaming gzip compressor (LZ77 + fixed Huffman deflate) - no ESP dependencies.
+ * Implementation details:
+ *   - Bounded window: EXPRESS_GZIP_WINDOW bytes of history, one allocation of
+ *     about 5 * EXPRESS_GZIP_WINDOW bytes per compressor,
+ *   - Matches are found with hash chains limited to EXPRESS_GZIP_CHAIN probes,
+ *   - Whole stream is one fixed Huffman block (no tables to build or send),
+ *   - Output (gzip header, data, CRC32 trailer) goes to a callback in small blocks.
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __EXDEFLATE__
+#define __EXDEFLATE__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* History size (power of 2, 1024 .. 16384) */
+#ifndef EXPRESS_GZIP_WINDOW
+#define EXPRESS_GZIP_WINDOW (4096)
+#endif
+/* Max hash chain probes per position (more = better ratio, slower) */
+#ifndef EXPRESS_GZIP_CHAIN
+#define EXPRESS_GZIP_CHAIN (8)
+#endif
+
+/*!
+ * \brief Compressed data consumer.
+ */
+typedef void (*ExDeflateOut)(void *ctx, const char *data, size_t len);
+
+/*!
+ * \brief gzip stream compressor.
+ *   ExDeflate z(out, ctx); if (z.ok()) { z.write(d, n); ... z.finish(); }
+ */
+class ExDeflate {
+public:
+    ExDeflate(ExDeflateOut out, void *ctx);
+    ~ExDeflate();
+    ExDeflate(const ExDeflate &) = delete;
+    ExDeflate &operator = (const ExDeflate &) = delete;
+
+    /* false when window could not be allocated */
+    bool ok() const { return m_win != NULL; }
+    /*!
+     * \brief Compress data (input is copied into the window before any output is produced).
+     */
+    void write(const char *d, size_t len);
+    /*!
+     * \brief Compress rest of input, write end of block and gzip trailer.
+     */
+    void finish();
+
+    uint32_t in() const { return m_isize; }
+    uint32_t out() const { return m_osize; }
+
+private:
+    void compress(bool last);
+    void slide();
+    void insert(size_t p);
+    size_t match(size_t *dist);
+    void literal(uint8_t c);
+    void copy(size_t len, size_t dist);
+    void bits(uint32_t v, int n);
+    void put(uint8_t c) { m_obuf[m_olen++] = c; if (m_olen == sizeof(m_obuf)) flush(); }
+    void flush();
+
+    ExDeflateOut m_out;
+    void        *m_ctx;
+    uint8_t     *m_win;                  /*!< 2 * window: history and lookahead.      */
+    uint16_t    *m_head;                 /*!< Hash -> last position + 1 (0 = none).   */
+    uint16_t    *m_prev;                 /*!< Position -> previous with the same hash. */
+    size_t       m_pos, m_end;           /*!< Next position to code, end of input.     */
+    uint32_t     m_bitbuf;
+    int          m_nbits;
+    uint32_t     m_crc, m_isize, m_osize;
+    bool         m_done;
+    size_t       m_olen;
+    uint8_t      m_obuf[128];
+};
+
+/*!
+ * \brief CRC32 (gzip, IEEE 802.3), crc = 0 for first block.
+ */
+uint32_t express_crc32(uint32_t crc, const void *data, size_t len);
+
+#endif
@@ -0,0 +1,118 @@
+/*
+ * Small callable wrapper with inline storage (needs C++11).
+ * Implementation details:
+ *   - Callable up to N bytes is stored inside the object (no heap allocation),
+ *   - Bigger callables (lambdas capturing std::string, std::function ...) are
+ *     copied to heap, so existing handlers keep working,
+ *   - Trivially copyable callables (plain functions, lambdas capturing pointers
+ *     and numbers) are copied with memcpy and need no destructor call.
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef EXFUNCTION_HPP
+#define EXFUNCTION_HPP
+
+#include <stddef.h>
+#include <string.h>
+#include <new>
+#include <utility>
+#include <type_traits>
+
+/* Inline storage size in bytes (bigger lambda captures go to heap) */
+#ifndef EXPRESS_CB_INLINE_SIZE
+#define EXPRESS_CB_INLINE_SIZE (4 * sizeof(void *))
+#endif
+
+template <typename Sig, size_t N = EXPRESS_CB_INLINE_SIZE> class ExFunction;
+
+template <typename R, typename... Args, size_t N>
+class ExFunction<R(Args...), N> {
+	typedef R (*call_t)(void *, Args...);
+	typedef void (*ops_t)(void *dst, const void *src, bool destroy);
+
+	/* Accept callables returning something convertible to R (R = void accepts anything) */
+	template <typename F, typename = void>
+	struct callable : std::false_type {};
+	template <typename F>
+	struct callable<F, decltype(void(std::declval<F &>()(std::declval<Args>()...)))>
+		: std::integral_constant<bool, std::is_void<R>::value ||
+			std::is_convertible<decltype(std::declval<F &>()(std::declval<Args>()...)), R>::value> {};
+
+public:
+	ExFunction() : m_buf(), m_call(NULL), m_ops(NULL) {}
+	ExFunction(std::nullptr_t) : m_buf(), m_call(NULL), m_ops(NULL) {}
+
+	template <typename F, typename T = typename std::decay<F>::type,
+	          typename = typename std::enable_if<!std::is_same<T, ExFunction>::value && callable<T>::value>::type>
+	ExFunction(F &&f) : m_buf() {
+		init<T>(std::forward<F>(f), std::integral_constant<bool, inplace<T>::value>());
+	}
+
+	ExFunction(const ExFunction &o) : m_buf(), m_call(o.m_call), m_ops(o.m_ops) { copyFrom(o); }
+	ExFunction &operator = (const ExFunction &o) {
+		if (this != &o) { reset(); m_call = o.m_call; m_ops = o.m_ops; copyFrom(o); }
+		return *this;
+	}
+	ExFunction &operator = (std::nullptr_t) { reset(); return *this; }
+	~ExFunction() { reset(); }
+
+	R operator()(Args... a) const { return m_call(&m_buf, std::forward<Args>(a)...); }
+	explicit operator bool() const { return m_call != NULL; }
+
+private:
+	template <typename T>
+	struct inplace : std::integral_constant<bool, (sizeof(T) <= N) &&
+		(alignof(T) <= (alignof(void *) < alignof(double) ? alignof(double) : alignof(void *)))> {};
+	static_assert(N >= sizeof(void *), "ExFunction: inline storage must hold a pointer");
+
+	template <typename T, typename F>
+	void init(F &&f, std::true_type) {
+		new (&m_buf) T(std::forward<F>(f));
+		m_call = &invoke<T>;
+		m_ops  = std::is_trivially_copyable<T>::value ? NULL : &manage<T>;
+	}
+	/* Too big for inline storage - buffer holds pointer to heap copy */
+	template <typename T, typename F>
+	void init(F &&f, std::false_type) {
+		*reinterpret_cast<T **>(&m_buf) = new T(std::forward<F>(f));
+		m_call = &invokeHeap<T>;
+		m_ops  = &manageHeap<T>;
+	}
+
+	template <typename T>
+	static R invoke(void *p, Args... a) { return (R)(*static_cast<T *>(p))(std::forward<Args>(a)...); }
+	template <typename T>
+	static R invokeHeap(void *p, Args... a) { return (R)(**static_cast<T **>(p))(std::forward<Args>(a)...); }
+
+	template <typename T>
+	static void manage(void *dst, const void *src, bool destroy) {
+		if (destroy) static_cast<T *>(dst)->~T();
+		else new (dst) T(*static_cast<const T *>(src));
+	}
+	template <typename T>
+	static void manageHeap(void *dst, const void *src, bool destroy) {
+		if (destroy) delete *static_cast<T **>(dst);
+		else *static_cast<T **>(dst) = new T(**static_cast<T *const *>(src));
+	}
+
+	void copyFrom(const ExFunction &o) {
+		if (m_ops) m_ops(&m_buf, &o.m_buf, false);
+		else memcpy(&m_buf, &o.m_buf, sizeof(m_buf));
+	}
+	void reset() {
+		if (m_ops) m_ops(&m_buf, NULL, true);
+		m_call = NULL;
+		m_ops = NULL;
+	}
+
+	/* Value initialised - memcpy in copyFrom() never reads indeterminate bytes */
+	mutable typename std::aligned_storage<N, alignof(void *) < alignof(double) ? alignof(double) : alignof(void *)>::type m_buf;
+	call_t m_call;
+	ops_t  m_ops;
+};
+
+#endif // EXFUNCTION_HPP
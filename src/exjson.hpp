@@ -1,7 +1,8 @@
 /*
  * Simple JSON parse/serialize class (needs C++11).
  * Implementation details:
- *   - Use COW (Copy on Write) technique.
+ *   - Use COW (Copy on Write) technique,
+ *   - Serialization writes to ExJSONSink (string, response stream ...) without temporary strings.
  *
  * Author: Rafal Vonau <rafal.vonau@gmail.com>
  *
@@ -16,6 +17,8 @@
 #include <vector>
 #include <map>
 #include <memory>
+#include <string>
+#include <stdio.h>
 #include "math.h"
 #include "string.h"
 
@@ -28,6 +31,26 @@ class ExJSONVal;
 class ExJSONData;
 
 typedef std::shared_ptr<ExJSONData> ExJSONDataPtr;
+
+/*!
+ * \brief Serialization output.
+ */
+class ExJSONSink {
+public:
+	virtual ~ExJSONSink() {}
+	virtual void write(const char *s, size_t len) = 0;
+};
+
+/*!
+ * \brief Serialize to std::string (see ExJSONVal::dump()).
+ */
+class ExJSONStringSink : public ExJSONSink {
+public:
+	ExJSONStringSink(std::string &s) : m_s(s) {}
+	void write(const char *s, size_t len) override { m_s.append(s, len); }
+private:
+	std::string &m_s;
+};
 typedef std::vector<ExJSONVal> ExJSONValVec;
 typedef std::map<std::string, ExJSONVal> ExJSONValMap;
 
@@ -432,7 +455,43 @@ public:
 		return false;
 	}
 
-	std::string dump() const{ std::string res; res.reserve(128); dumpInt(res); return res; }
+	std::string dump() const{ std::string res; res.reserve(128); ExJSONStringSink s(res); dump(s); return res; }
+
+	/*!
+	 * \brief Write JSON text to sink (memory use does not depend on document size).
+	 */
+	void dump(ExJSONSink &s) const {
+		switch(d->m_type) {
+			case ExJSONValNull:   s.write("null", 4); break;
+			case ExJSONValInt:    dumpNumber(s, d->m_u.i); break;
+			case ExJSONValBool:   if (d->m_u.b) s.write("true", 4); else s.write("false", 5); break;
+			case ExJSONValDouble: dumpNumber(s, d->m_u.d); break;
+			case ExJSONValString: dumpString(s, *(d->m_u.s)); break;
+			case ExJSONValArray: {
+				bool first = true;
+				s.write("[", 1);
+				for (const auto &i: *(d->m_u.v)) {
+					if (!first) s.write(",", 1);
+					first = false;
+					i.dump(s);
+				}
+				s.write("]", 1);
+			} break;
+			case ExJSONValObject: {
+				bool first = true;
+				s.write("{", 1);
+				for (const auto &i: *(d->m_u.m)) {
+					if (!first) s.write(",", 1);
+					first = false;
+					dumpString(s, i.first);
+					s.write(":", 1);
+					i.second.dump(s);
+				}
+				s.write("}", 1);
+			} break;
+			default: break;
+		}
+	}
 
 	/* Simplified operators */
 	bool operator == (const ExJSONVal& b) const {
@@ -613,40 +672,20 @@ public:
 
 
 private:
-	/*!
-	 * \brief Construct JSON string.
-	 * \return JSON string.
-	 */
-	void dumpInt(std::string &s) const {
-		switch(d->m_type) {
-			case ExJSONValNull:   s.append("null"); break;
-			case ExJSONValInt:    s.append(std::to_string(d->m_u.i)); break;
-			case ExJSONValBool:   s.append((d->m_u.b)?"true":"false"); break;
-			case ExJSONValDouble: s.append(std::to_string(d->m_u.d)); break;
-			case ExJSONValString: s.append("\"").append(getString()).append("\""); break;
-			case ExJSONValArray: {
-				s.append("[");
-				ExJSONValVec *v = d->m_u.v;
-				for (const auto &i: *v) {
-					i.dumpInt(s);
-					s.append(",");
-				}
-				if (v->size() > 0) s.resize(s.size() - 1);
-				s.append("]");
-			} break;
-			case ExJSONValObject: {
-				s.append("{");
-				ExJSONValMap *v = d->m_u.m;
-				for (const auto &i: *v) {
-					s.append("\"").append(i.first).append("\":");
-					i.second.dumpInt(s);
-					s.append(",");
-				}
-				if (v->size() > 0) s.resize(s.size() - 1);
-				s.append("}");
-			} break;
-			default: break;
-		}
+	/* Leaf writers (number buffer is not kept on stack during recursion) */
+	static void dumpNumber(ExJSONSink &s, long v) {
+		char b[24];
+		s.write(b, snprintf(b, sizeof(b), "%ld", v));
+	}
+	static void dumpNumber(ExJSONSink &s, double v) {
+		char b[48];
+		int n = snprintf(b, sizeof(b), "%f", v);
+		if ((n > 0) && ((size_t)n < sizeof(b))) s.write(b, n); else { std::string t = std::to_string(v); s.write(t.data(), t.size()); }
+	}
+	static void dumpString(ExJSONSink &s, const std::string &v) {
+		s.write("\"", 1);
+		s.write(v.data(), v.size());
+		s.write("\"", 1);
 	}
 
 private:
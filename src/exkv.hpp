@@ -0,0 +1,93 @@
+/*
+ * Small key/value table for request parameters (needs C++11).
+ * Implementation details:
+ *   - First N entries are stored inline, more entries spill to the request arena,
+ *   - Lookup is linear (length compared first), lists are short,
+ *   - Duplicated keys are kept, lookup returns the first one (like std::map::insert).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef EXKV_HPP
+#define EXKV_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <exarena.hpp>
+
+/* Number of entries stored inline */
+#ifndef EXPRESS_KV_INLINE
+#define EXPRESS_KV_INLINE (8)
+#endif
+
+struct ExKV {
+	const char *key;
+	const char *val;        /*!< Decoded value.                                  */
+	const char *raw;        /*!< Undecoded value (not NUL terminated).           */
+	size_t      key_len;
+	size_t      raw_len;
+};
+
+template <size_t N = EXPRESS_KV_INLINE>
+class ExKVTable {
+public:
+	ExKVTable(ExArena *a) : m_arena(a), m_data(m_inline), m_count(0), m_cap(N) {}
+	ExKVTable(const ExKVTable &) = delete;
+	ExKVTable &operator = (const ExKVTable &) = delete;
+
+	/*!
+	 * \brief Add entry (key and value must stay valid for the table lifetime).
+	 */
+	bool add(const char *key, const char *val, const char *raw = NULL, size_t raw_len = 0) {
+		if ((m_count == m_cap) && (!grow())) return false;
+		if (!raw) { raw = val; raw_len = strlen(val); }
+		m_data[m_count++] = { key, val, raw, strlen(key), raw_len };
+		return true;
+	}
+
+	/*!
+	 * \brief Find entry by key (NULL when not found).
+	 */
+	const ExKV *entry(const char *key) const {
+		size_t l = strlen(key);
+		for (const ExKV *i = begin(); i != end(); ++i) {
+			if ((i->key_len == l) && (memcmp(i->key, key, l) == 0)) return i;
+		}
+		return NULL;
+	}
+
+	/*!
+	 * \brief Find value by key (NULL when not found).
+	 */
+	const char *find(const char *key) const {
+		const ExKV *i = entry(key);
+		return i ? i->val : NULL;
+	}
+
+	void clear() { m_data = m_inline; m_count = 0; m_cap = N; }
+	size_t size() const { return m_count; }
+	bool empty() const { return m_count == 0; }
+	const ExKV *begin() const { return m_data; }
+	const ExKV *end() const { return m_data + m_count; }
+
+private:
+	bool grow() {
+		ExKV *d = (ExKV *)m_arena->alloc(2 * m_cap * sizeof(ExKV), alignof(ExKV));
+		if (!d) return false;
+		memcpy(d, m_data, m_count * sizeof(ExKV));
+		m_data = d;
+		m_cap *= 2;
+		return true;
+	}
+
+	ExArena *m_arena;
+	ExKV    *m_data;
+	size_t   m_count, m_cap;
+	ExKV     m_inline[N];
+};
+
+#endif // EXKV_HPP
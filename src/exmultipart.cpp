@@ -0,0 +1,283 @@
+/*
+ * Streaming multipart/form-data parser.
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <string.h>
+#include <strings.h>
+#include "exmultipart.h"
+
+/*!
+ * \brief Get boundary from Content-Type value (multipart/form-data; boundary=...).
+ */
+bool express_multipart_boundary(const ExSpan &ct, ExSpan *b)
+{
+    const char *s = ct.ptr, *e = ct.ptr + ct.len;
+
+    if ((ct.len < 10) || (strncasecmp(s, "multipart/", 10) != 0)) return false;
+    for (; s + 9 <= e; ++s) {
+        if (strncasecmp(s, "boundary=", 9) != 0) continue;
+        s += 9;
+        if ((s != e) && (*s == '"')) {
+            b->ptr = ++s;
+            while ((s != e) && (*s != '"')) s++;
+        } else {
+            b->ptr = s;
+            while ((s != e) && (*s != ';') && (*s != ' ')) s++;
+        }
+        b->len = s - b->ptr;
+        return (b->len > 0) && (b->len <= EXPRESS_MULTIPART_BOUNDARY);
+    }
+    return false;
+}
+
+ExMultipart::ExMultipart(const ExSpan &boundary, char *buf, size_t size, ExMultipartSelect select, void *ctx)
+{
+    m_buf    = buf;
+    m_size   = size;
+    m_len    = 0;
+    m_sink   = NULL;
+    m_select = select;
+    m_ctx    = ctx;
+    m_dlen   = boundary.len + 4;
+    memset(&m_part, 0, sizeof(m_part));
+    m_part.index = -1;
+    m_state = Failed;
+    if ((!buf) || (boundary.len == 0) || (boundary.len > EXPRESS_MULTIPART_BOUNDARY) || (size < 2 * m_dlen)) return;
+    /* Delimiter is CRLF--boundary, first one has no CRLF - start with it in the buffer */
+    memcpy(m_delim, "\r\n--", 4);
+    memcpy(m_delim + 4, boundary.ptr, boundary.len);
+    memcpy(m_buf, "\r\n", 2);
+    m_len = 2;
+    /* Horspool shift table */
+    for (int i = 0; i < 256; ++i) m_skip[i] = m_dlen;
+    for (size_t i = 0; i < m_dlen - 1; ++i) m_skip[(uint8_t)m_delim[i]] = m_dlen - 1 - i;
+    m_state = Preamble;
+}
+
+/*!
+ * \brief Find delimiter (returns len when not found).
+ */
+size_t ExMultipart::search(const char *p, size_t len) const
+{
+    const char last = m_delim[m_dlen - 1];
+    size_t i = 0;
+
+    while (i + m_dlen <= len) {
+        char c = p[i + m_dlen - 1];
+        if ((c == last) && (memcmp(p + i, m_delim, m_dlen - 1) == 0)) return i;
+        i += m_skip[(uint8_t)c];
+    }
+    return len;
+}
+
+/*!
+ * \brief Copy header parameter value (truncated).
+ */
+static void exmultipart_copy(char *d, const char *s, size_t len)
+{
+    if (len >= EXPRESS_MULTIPART_NAME) len = EXPRESS_MULTIPART_NAME - 1;
+    memcpy(d, s, len);
+    d[len] = '\0';
+}
+
+/*!
+ * \brief Parse part header line (Content-Disposition and Content-Type).
+ */
+bool ExMultipart::header(char *line, size_t len)
+{
+    const char *s = line, *e = line + len;
+
+    if ((len >= 13) && (strncasecmp(line, "Content-Type:", 13) == 0)) {
+        s += 13;
+        while ((s != e) && (*s == ' ')) s++;
+        exmultipart_copy(m_part.type, s, e - s);
+        return true;
+    }
+    if ((len < 20) || (strncasecmp(line, "Content-Disposition:", 20) != 0)) return true;
+    /* form-data; name="field"; filename="file.bin" */
+    s += 20;
+    while (s < e) {
+        const char *k, *v;
+        size_t kl, vl;
+        while ((s != e) && ((*s == ' ') || (*s == ';'))) s++;
+        k = s;
+        while ((s != e) && (*s != '=') && (*s != ';')) s++;
+        kl = s - k;
+        while ((kl) && (k[kl - 1] == ' ')) kl--;
+        if ((s == e) || (*s != '=')) continue;
+        s++;
+        if ((s != e) && (*s == '"')) {
+            v = ++s;
+            while ((s != e) && (*s != '"')) s++;
+            vl = s - v;
+            if (s != e) s++;
+        } else {
+            v = s;
+            while ((s != e) && (*s != ';')) s++;
+            vl = s - v;
+            while ((vl) && (v[vl - 1] == ' ')) vl--;
+        }
+        if ((kl == 4) && (strncasecmp(k, "name", 4) == 0)) exmultipart_copy(m_part.name, v, vl);
+        else if ((kl == 8) && (strncasecmp(k, "filename", 8) == 0)) exmultipart_copy(m_part.filename, v, vl);
+    }
+    return true;
+}
+
+bool ExMultipart::emit(const char *p, size_t len)
+{
+    if ((!len) || (!m_sink)) return true;
+    return m_sink->write(p, len);
+}
+
+bool ExMultipart::fail()
+{
+    abort();
+    return false;
+}
+
+void ExMultipart::abort()
+{
+    if (m_sink) m_sink->abort();
+    m_sink = NULL;
+    if (m_state != Done) m_state = Failed;
+}
+
+/*!
+ * \brief Process n bytes received into space().
+ */
+bool ExMultipart::commit(size_t n)
+{
+    size_t pos = 0;
+    bool more = true;
+
+    if (m_state == Failed) return false;
+    m_len += n;
+    while (more) {
+        char *p = m_buf + pos;
+        size_t l = m_len - pos;
+        switch (m_state) {
+            case Preamble:
+            case Body: {
+                size_t i = search(p, l);
+                if (i < l) {
+                    if (m_state == Body) {
+                        if (!emit(p, i)) return fail();
+                        if ((m_sink) && (!m_sink->end())) { m_sink = NULL; return fail(); }
+                        m_sink = NULL;
+                    }
+                    pos += i + m_dlen;
+                    m_state = Delimiter;
+                } else {
+                    /* Keep tail - may be the beginning of the delimiter */
+                    size_t keep = (l < m_dlen - 1) ? l : m_dlen - 1;
+                    if ((m_state == Body) && (!emit(p, l - keep))) return fail();
+                    pos += l - keep;
+                    more = false;
+                }
+            } break;
+            case Delimiter: {
+                if (l < 2) { more = false; break; }
+                if ((p[0] == '-') && (p[1] == '-')) {
+                    /* Close delimiter - ignore epilogue */
+                    m_state = Done;
+                    pos = m_len;
+                } else if ((p[0] == ' ') || (p[0] == '\t')) {
+                    /* Transport padding */
+                    pos++;
+                } else if ((p[0] == '\r') && (p[1] == '\n')) {
+                    int idx = m_part.index + 1;
+                    memset(&m_part, 0, sizeof(m_part));
+                    m_part.index = idx;
+                    pos += 2;
+                    m_state = Headers;
+                } else {
+                    return fail();
+                }
+            } break;
+            case Headers: {
+                char *nl = (char *)memchr(p, '\n', l);
+                size_t ll;
+                if (!nl) {
+                    /* Header line longer than buffer */
+                    if (l >= m_size) return fail();
+                    more = false;
+                    break;
+                }
+                ll = nl - p;
+                pos += ll + 1;
+                if ((ll) && (p[ll - 1] == '\r')) ll--;
+                if (ll) {
+                    header(p, ll);
+                    break;
+                }
+                /* Empty line - part data follows */
+                m_sink = m_select ? m_select(m_ctx, m_part) : NULL;
+                if ((m_sink) && (!m_sink->begin(m_part))) { m_sink = NULL; return fail(); }
+                m_state = Body;
+            } break;
+            case Done:
+                pos = m_len;
+                more = false;
+                break;
+            case Failed:
+                return false;
+        }
+    }
+    memmove(m_buf, m_buf + pos, m_len - pos);
+    m_len -= pos;
+    return true;
+}
+
+/*!
+ * \brief Process data from any source (copied into buffer).
+ */
+bool ExMultipart::feed(const char *data, size_t len)
+{
+    while (len) {
+        size_t n;
+        char *d = space(&n);
+        if (n > len) n = len;
+        if (n == 0) return fail();
+        memcpy(d, data, n);
+        if (!commit(n)) return false;
+        data += n;
+        len -= n;
+    }
+    return m_state != Failed;
+}
+
+//===========================================================================
+//===========================--- File sink  ---==============================
+//===========================================================================
+
+bool ExFileSink::begin(const ExMultipartPart &)
+{
+    if (m_f) fclose(m_f);
+    m_f = fopen(m_path, "wb");
+    return m_f != NULL;
+}
+
+bool ExFileSink::write(const char *data, size_t len)
+{
+    return (m_f) && (fwrite(data, 1, len, m_f) == len);
+}
+
+bool ExFileSink::end()
+{
+    bool ok = (m_f) && (fclose(m_f) == 0);
+    m_f = NULL;
+    return ok;
+}
+
+void ExFileSink::abort()
+{
+    if (!m_f) return;
+    fclose(m_f);
+    m_f = NULL;
+    remove(m_path);
+}
@@ -0,0 +1,157 @@
+/*
+ * Streaming multipart/form-data parser - no ESP dependencies.
+ * Implementation details:
+ *   - Body is received straight into one fixed buffer (space/commit),
+ *   - Boundary is searched with Boyer-Moore-Horspool, the unmatched tail
+ *     (boundary length - 1 bytes) is kept for the next chunk,
+ *   - Part data is passed to a sink chosen per part (OTA, file, string ...).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __EXMULTIPART__
+#define __EXMULTIPART__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string>
+#include "exparse.h"
+
+/* Parser buffer size (longest header line must fit) */
+#ifndef EXPRESS_MULTIPART_BUF
+#define EXPRESS_MULTIPART_BUF (4096)
+#endif
+/* Max length of name, filename and content type of a part */
+#ifndef EXPRESS_MULTIPART_NAME
+#define EXPRESS_MULTIPART_NAME (96)
+#endif
+/* Max boundary length (RFC 2046 allows 70) */
+#define EXPRESS_MULTIPART_BOUNDARY (70)
+
+/*!
+ * \brief Part headers.
+ */
+struct ExMultipartPart {
+    char   name[EXPRESS_MULTIPART_NAME];        /*!< Form field name.                       */
+    char   filename[EXPRESS_MULTIPART_NAME];    /*!< File name (empty for plain fields).    */
+    char   type[EXPRESS_MULTIPART_NAME];        /*!< Content-Type (empty = text/plain).     */
+    int    index;                               /*!< Part number (from 0).                  */
+};
+
+/*!
+ * \brief Part data consumer.
+ */
+class ExMultipartSink {
+public:
+    virtual ~ExMultipartSink() {}
+    /* Part headers parsed (false = abort upload) */
+    virtual bool begin(const ExMultipartPart &p) { (void)p; return true; }
+    /* Part data (false = abort upload) */
+    virtual bool write(const char *data, size_t len) = 0;
+    /* Part complete (false = abort upload) */
+    virtual bool end() { return true; }
+    /* Upload aborted or broken (after begin) */
+    virtual void abort() {}
+};
+
+/*!
+ * \brief Collect part into string (small fields, JSON documents).
+ */
+class ExStringSink : public ExMultipartSink {
+public:
+    ExStringSink(size_t max = 4096) : m_max(max) {}
+    bool begin(const ExMultipartPart &) override { m_str.clear(); return true; }
+    bool write(const char *data, size_t len) override {
+        if (m_str.size() + len > m_max) return false;
+        m_str.append(data, len);
+        return true;
+    }
+    void abort() override { m_str.clear(); }
+    std::string &str() { return m_str; }
+private:
+    size_t      m_max;
+    std::string m_str;
+};
+
+/*!
+ * \brief Write part into file (path on VFS like /spiffs/config.json).
+ */
+class ExFileSink : public ExMultipartSink {
+public:
+    ExFileSink(const char *path) : m_path(path), m_f(NULL) {}
+    ~ExFileSink() { if (m_f) fclose(m_f); }
+    bool begin(const ExMultipartPart &p) override;
+    bool write(const char *data, size_t len) override;
+    bool end() override;
+    void abort() override;
+private:
+    const char *m_path;
+    FILE       *m_f;
+};
+
+/*!
+ * \brief Choose sink for part (NULL = skip part).
+ */
+typedef ExMultipartSink *(*ExMultipartSelect)(void *ctx, const ExMultipartPart &p);
+
+/*!
+ * \brief Get boundary from Content-Type value (multipart/form-data; boundary=...).
+ */
+bool express_multipart_boundary(const ExSpan &ct, ExSpan *b);
+
+/*!
+ * \brief Incremental multipart parser.
+ *   for (;;) { p = mp.space(&n); r = recv(p, n); if ((r <= 0) || (!mp.commit(r))) break; }
+ */
+class ExMultipart {
+public:
+    ExMultipart(const ExSpan &boundary, char *buf, size_t size, ExMultipartSelect select, void *ctx);
+    ~ExMultipart() { if (!done()) abort(); }
+
+    /*!
+     * \brief Free space in buffer for next receive.
+     */
+    char *space(size_t *len) { *len = m_size - m_len; return m_buf + m_len; }
+    /*!
+     * \brief Process n bytes received into space().
+     * \return false on error (parsing stopped).
+     */
+    bool commit(size_t n);
+    /*!
+     * \brief Process data from any source (copied into buffer).
+     */
+    bool feed(const char *data, size_t len);
+    /*!
+     * \brief Abort current part (body ended early or receive error).
+     */
+    void abort();
+
+    bool done() const { return m_state == Done; }
+    bool failed() const { return m_state == Failed; }
+    int  parts() const { return m_part.index + 1; }
+
+private:
+    enum State { Preamble, Delimiter, Headers, Body, Done, Failed };
+
+    size_t search(const char *p, size_t len) const;
+    bool   header(char *line, size_t len);
+    bool   emit(const char *p, size_t len);
+    bool   fail();
+
+    char               m_delim[EXPRESS_MULTIPART_BOUNDARY + 4];   /*!< "\r\n--" + boundary. */
+    size_t             m_dlen;
+    uint8_t            m_skip[256];                               /*!< BMH shift table.     */
+    char              *m_buf;
+    size_t             m_size, m_len;
+    State              m_state;
+    ExMultipartPart    m_part;
+    ExMultipartSink   *m_sink;
+    ExMultipartSelect  m_select;
+    void              *m_ctx;
+};
+
+#endif
@@ -0,0 +1,353 @@
+/*
+ * Request string parsers (query, cookie, numbers) - no ESP dependencies.
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include "exparse.h"
+
+/* Word used by delimiter scanner (32 bit on ESP32, 64 bit on host) */
+typedef uintptr_t exword_t;
+#define EXWORD_ONES   ((exword_t)-1 / 0xFF)
+#define EXWORD_HIGHS  (EXWORD_ONES * 0x80)
+
+/*!
+ * \brief Non zero if any byte of w is equal to c.
+ */
+static inline exword_t exparse_has(exword_t w, unsigned char c)
+{
+    exword_t v = w ^ (EXWORD_ONES * c);
+    return (v - EXWORD_ONES) & ~v & EXWORD_HIGHS;
+}
+
+/*!
+ * \brief Query delimiters: & ; = % +
+ */
+struct ExQuerySet {
+    static bool is(char c) { return (c == '&') || (c == ';') || (c == '=') || (c == '%') || (c == '+'); }
+    static exword_t word(exword_t w) {
+        return exparse_has(w, '&') | exparse_has(w, ';') | exparse_has(w, '=') | exparse_has(w, '%') | exparse_has(w, '+');
+    }
+    enum { trim = 0 };
+};
+
+/*!
+ * \brief Cookie delimiters: ; = %
+ */
+struct ExCookieSet {
+    static bool is(char c) { return (c == ';') || (c == '=') || (c == '%'); }
+    static exword_t word(exword_t w) { return exparse_has(w, ';') | exparse_has(w, '=') | exparse_has(w, '%'); }
+    enum { trim = 1 };
+};
+
+static inline int exparse_hex(char c)
+{
+    if ((c >= '0') && (c <= '9')) return c - '0';
+    c |= 0x20;
+    if ((c >= 'a') && (c <= 'f')) return c - 'a' + 10;
+    return -1;
+}
+
+template <class S>
+static inline void exparse_emit(const char *k, const char *v, const char *raw, const char *raw_end, ExKVCB cb, void *ctx)
+{
+    if (S::trim) {
+        while (*k == ' ') k++;
+        while (*v == ' ') v++;
+        while ((raw < raw_end) && (*raw == ' ')) raw++;
+    }
+    cb(ctx, k, v, raw, raw_end - raw);
+}
+
+/*!
+ * \brief Split key/value list and percent decode keys and values in the same pass.
+ *   Long runs of plain characters are copied a word at a time (aligned loads, never past the end).
+ * \param src - source string (left untouched when dst != src, raw values point here),
+ * \param dst - output buffer (len + 1 bytes, may be equal to src),
+ * \param len - source length.
+ */
+template <class S>
+static void exparse_tokenize(const char *src, char *dst, size_t len, ExKVCB cb, void *ctx)
+{
+    const char *r = src, *e = src + len, *raw = NULL;
+    char *w = dst, *key = dst, *val = NULL;
+    size_t run = 0;
+
+    while (r != e) {
+        char c;
+        /* Long run of plain characters (like session id) - skip aligned words without delimiter */
+        if ((run >= sizeof(exword_t)) && (((uintptr_t)r & (sizeof(exword_t) - 1)) == 0)) {
+            exword_t x;
+            while ((size_t)(e - r) >= sizeof(exword_t)) {
+                memcpy(&x, __builtin_assume_aligned(r, sizeof(exword_t)), sizeof(x));
+                if (S::word(x)) break;
+                memcpy(w, &x, sizeof(x));
+                w += sizeof(x);
+                r += sizeof(x);
+            }
+            run = 0;
+            if (r == e) break;
+        }
+        /* Single bytes up to delimiter */
+        c = *r;
+        if (!S::is(c)) {
+            *w++ = c;
+            r++;
+            run++;
+            continue;
+        }
+        run = 0;
+        r++;
+        if (c == '%') {
+            int h, l;
+            if (((e - r) >= 2) && ((h = exparse_hex(r[0])) >= 0) && ((l = exparse_hex(r[1])) >= 0)) {
+                *w++ = (char)((h << 4) | l);
+                r += 2;
+            } else {
+                *w++ = '%';
+            }
+        } else if (c == '+') {
+            *w++ = ' ';
+        } else if (c == '=') {
+            /* First '=' splits key and value */
+            if (val) { *w++ = '='; continue; }
+            *w++ = '\0';
+            val = w;
+            raw = r;
+        } else {
+            /* Pair separator (key without value is skipped) */
+            *w++ = '\0';
+            if (val) exparse_emit<S>(key, val, raw, r - 1, cb, ctx);
+            key = w;
+            val = NULL;
+        }
+    }
+    *w = '\0';
+    if (val) exparse_emit<S>(key, val, raw, e, cb, ctx);
+}
+
+/*!
+ * \brief Split query string like nr=0&val=3 (decoded into dst, '+' = space).
+ */
+void express_parse_query(const char *s, char *dst, size_t len, ExKVCB cb, void *ctx)
+{
+    exparse_tokenize<ExQuerySet>(s, dst, len, cb, ctx);
+}
+
+/*!
+ * \brief Split cookie string like a=1; b=2 (decoded into dst).
+ */
+void express_parse_cookie(const char *s, char *dst, size_t len, ExKVCB cb, void *ctx)
+{
+    exparse_tokenize<ExCookieSet>(s, dst, len, cb, ctx);
+}
+
+/*!
+ * \brief Parse integer from span (accepts 0x prefixed hex like sscanf("0x%x") or decimal like sscanf("%d")).
+ */
+bool express_parse_int(const char *s, size_t len, int *v)
+{
+    const char *e = s + len;
+    bool neg = false;
+    int r = 0;
+
+    while ((s != e) && (*s == ' ')) s++;
+    if (((e - s) > 2) && (s[0] == '0') && (s[1] == 'x') && isxdigit((unsigned char)s[2])) {
+        unsigned u;
+        express_parse_uint(s + 2, e - s - 2, &u, 16);
+        *v = (int)u;
+        return true;
+    }
+    if ((s != e) && ((*s == '-') || (*s == '+'))) { neg = (*s == '-'); s++; }
+    if ((s == e) || (!isdigit((unsigned char)*s))) return false;
+    for (; (s != e) && isdigit((unsigned char)*s); s++) r = r * 10 + (*s - '0');
+    *v = neg ? -r : r;
+    return true;
+}
+
+/*!
+ * \brief Parse unsigned integer from span (base 10 or 16, stops on first invalid character).
+ */
+bool express_parse_uint(const char *s, size_t len, unsigned *v, int base)
+{
+    const char *e = s + len;
+    unsigned r = 0;
+
+    if ((s == e) || ((base == 16) ? !isxdigit((unsigned char)*s) : !isdigit((unsigned char)*s))) return false;
+    for (; s != e; s++) {
+        unsigned d;
+        if (isdigit((unsigned char)*s)) d = *s - '0';
+        else if ((base == 16) && isxdigit((unsigned char)*s)) d = (*s | 0x20) - 'a' + 10;
+        else break;
+        r = r * base + d;
+    }
+    *v = r;
+    return true;
+}
+
+/*!
+ * \brief Digit value (0xFF when not a hex digit).
+ */
+static inline unsigned exparse_digit(char c)
+{
+    unsigned d = (unsigned char)c - '0';
+    if (d < 10) return d;
+    d = ((unsigned char)c | 0x20) - 'a';
+    return (d < 6) ? d + 10 : 0xFF;
+}
+
+/*!
+ * \brief Parse whole span as unsigned 64 bit (base 10, 16 or 0 = decimal or 0x prefixed hex).
+ *   Like std::from_chars - no spaces, no trailing characters, overflow is an error.
+ */
+bool express_parse_u64(const char *s, size_t len, uint64_t *v, int base)
+{
+    const char *e = s + len;
+    uint64_t r = 0;
+
+    if (base == 0) {
+        base = 10;
+        if ((len > 2) && (s[0] == '0') && ((s[1] | 0x20) == 'x')) { base = 16; s += 2; }
+    }
+    if (s == e) return false;
+    for (; s != e; s++) {
+        unsigned d = exparse_digit(*s);
+        if (d >= (unsigned)base) return false;
+        if (r > (UINT64_MAX - d) / base) return false;
+        r = r * base + d;
+    }
+    *v = r;
+    return true;
+}
+
+/*!
+ * \brief Parse whole span as signed 64 bit (optional sign, decimal or 0x prefixed hex).
+ */
+bool express_parse_i64(const char *s, size_t len, int64_t *v)
+{
+    bool neg = false;
+    uint64_t u;
+
+    if ((len) && ((*s == '-') || (*s == '+'))) { neg = (*s == '-'); s++; len--; }
+    if (!express_parse_u64(s, len, &u, 0)) return false;
+    if (u > (neg ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX)) return false;
+    *v = neg ? (int64_t)(0 - u) : (int64_t)u;
+    return true;
+}
+
+/*!
+ * \brief Parse whole span as floating point ([sign] digits [.digits] [e[sign]digits]).
+ *   Up to 19 significant digits are exact, scaling by 10^exp may differ from strtod in the last bit.
+ */
+bool express_parse_double(const char *s, size_t len, double *v)
+{
+    static const double p10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+    const char *e = s + len;
+    bool neg = false, digits = false;
+    uint64_t m = 0;
+    int exp = 0, nd = 0;
+    double r;
+
+    if ((s != e) && ((*s == '-') || (*s == '+'))) { neg = (*s == '-'); s++; }
+    for (; (s != e) && ((unsigned)(*s - '0') < 10); s++, digits = true) {
+        if (nd < 19) { m = m * 10 + (*s - '0'); if (m) nd++; } else exp++;
+    }
+    if ((s != e) && (*s == '.')) {
+        for (s++; (s != e) && ((unsigned)(*s - '0') < 10); s++, digits = true) {
+            if (nd < 19) { m = m * 10 + (*s - '0'); if (m) nd++; exp--; }
+        }
+    }
+    if (!digits) return false;
+    if ((s != e) && ((*s | 0x20) == 'e')) {
+        bool eneg = false;
+        int x = 0;
+        s++;
+        if ((s != e) && ((*s == '-') || (*s == '+'))) { eneg = (*s == '-'); s++; }
+        if (s == e) return false;
+        for (; (s != e) && ((unsigned)(*s - '0') < 10); s++) if (x < 10000) x = x * 10 + (*s - '0');
+        exp += eneg ? -x : x;
+    }
+    if (s != e) return false;
+    r = (double)m;
+    if (m) {
+        while (exp > 22) { r *= 1e22; exp -= 22; }
+        while (exp < -22) { r /= 1e22; exp += 22; }
+        r = (exp < 0) ? r / p10[-exp] : r * p10[exp];
+    }
+    *v = neg ? -r : r;
+    return true;
+}
+
+/*!
+ * \brief Parse whole span as bool (1/0, true/false, on/off, yes/no - case insensitive).
+ */
+bool express_parse_bool(const char *s, size_t len, bool *v)
+{
+    static const struct { const char *s; bool v; } tab[] = {
+        { "1", true }, { "0", false }, { "true", true }, { "false", false },
+        { "on", true }, { "off", false }, { "yes", true }, { "no", false }
+    };
+    for (size_t i = 0; i < sizeof(tab) / sizeof(tab[0]); ++i) {
+        if ((strlen(tab[i].s) == len) && (strncasecmp(s, tab[i].s, len) == 0)) { *v = tab[i].v; return true; }
+    }
+    return false;
+}
+
+/*!
+ * \brief Parse qvalue ("0", "0.5", "1.000") as thousandths (1000 when invalid).
+ */
+static int exparse_qvalue(const char *s, const char *e)
+{
+    int v, m = 1000;
+
+    if ((s == e) || (*s < '0') || (*s > '1')) return 1000;
+    v = (*s++ - '0') * 1000;
+    if ((s != e) && (*s == '.')) {
+        s++;
+        while ((s != e) && (*s >= '0') && (*s <= '9') && (m > 1)) {
+            m /= 10;
+            v += (*s++ - '0') * m;
+        }
+    }
+    return (v > 1000) ? 1000 : v;
+}
+
+/*!
+ * \brief Quality of content coding in Accept-Encoding value (0 .. 1000, 0 = not acceptable).
+ */
+int express_encoding_q(const ExSpan &ae, const char *coding)
+{
+    const char *s = ae.ptr, *e = ae.ptr + ae.len;
+    size_t cl = strlen(coding);
+    int q = -1, star = -1;
+
+    while (s < e) {
+        const char *t;
+        size_t tl;
+        int v = 1000;
+        while ((s != e) && ((*s == ' ') || (*s == '\t') || (*s == ','))) s++;
+        t = s;
+        while ((s != e) && (*s != ',') && (*s != ';') && (*s != ' ') && (*s != '\t')) s++;
+        tl = s - t;
+        /* Parameters - only q is used */
+        while ((s != e) && (*s != ',')) {
+            if (*s++ != ';') continue;
+            while ((s != e) && (*s == ' ')) s++;
+            if ((e - s >= 2) && ((*s | 0x20) == 'q') && (s[1] == '=')) v = exparse_qvalue(s + 2, e);
+        }
+        if ((tl == cl) && (strncasecmp(t, coding, cl) == 0)) q = v;
+        else if ((tl == 1) && (*t == '*')) star = v;
+    }
+    if (q >= 0) return q;
+    if (star >= 0) return star;
+    /* RFC 7231 5.3.4 - identity is acceptable unless excluded */
+    return (strcasecmp(coding, "identity") == 0) ? 1 : 0;
+}
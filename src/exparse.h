@@ -0,0 +1,132 @@
+/*
+ * Request string parsers (query, cookie, numbers) - no ESP dependencies.
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __EXPARSE__
+#define __EXPARSE__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits>
+
+/*!
+ * \brief Non owning string view (not NUL terminated unless stated).
+ */
+struct ExSpan {
+    const char *ptr;
+    size_t      len;
+
+    bool empty() const { return len == 0; }
+    /* Case sensitive substring search */
+    bool contains(const char *s) const {
+        size_t l = strlen(s);
+        for (size_t i = 0; (l <= len) && (i <= len - l); ++i) if (memcmp(ptr + i, s, l) == 0) return true;
+        return false;
+    }
+    bool equals(const char *s) const { return (strlen(s) == len) && (memcmp(ptr, s, len) == 0); }
+};
+
+/*!
+ * \brief Key/value callback.
+ *   key and val are decoded and NUL terminated,
+ *   raw/raw_len is the undecoded value in the source string (not NUL terminated).
+ */
+typedef void (*ExKVCB)(void *ctx, const char *key, const char *val, const char *raw, size_t raw_len);
+
+/*!
+ * \brief Split query string like nr=0&val=3 (decoded into dst, '+' = space).
+ */
+void express_parse_query(const char *s, char *dst, size_t len, ExKVCB cb, void *ctx);
+
+/*!
+ * \brief Split cookie string like a=1; b=2 (decoded into dst).
+ */
+void express_parse_cookie(const char *s, char *dst, size_t len, ExKVCB cb, void *ctx);
+
+/*!
+ * \brief Parse integer from span (0x prefixed hex or decimal).
+ */
+bool express_parse_int(const char *s, size_t len, int *v);
+
+/*!
+ * \brief Parse unsigned integer from span (base 10 or 16).
+ */
+bool express_parse_uint(const char *s, size_t len, unsigned *v, int base = 10);
+
+/*!
+ * \brief Strict parsers (whole span, overflow checked - like std::from_chars).
+ */
+bool express_parse_u64(const char *s, size_t len, uint64_t *v, int base = 0);
+bool express_parse_i64(const char *s, size_t len, int64_t *v);
+bool express_parse_double(const char *s, size_t len, double *v);
+bool express_parse_bool(const char *s, size_t len, bool *v);
+
+/*!
+ * \brief Quality of content coding in Accept-Encoding value (0 .. 1000, 0 = not acceptable).
+ *   Explicit entry wins over "*", identity is acceptable (1) unless excluded.
+ */
+int express_encoding_q(const ExSpan &ae, const char *coding);
+
+/*!
+ * \brief Hex value without 0x prefix (ExParse<ExHex>, type is uint32_t).
+ */
+struct ExHex {};
+
+/*!
+ * \brief Typed value parser used by ExRequest::getArg<T> / getParam<T>.
+ *   Signed and unsigned types accept decimal or 0x prefixed hex, range is checked.
+ */
+template <typename T, bool S>
+struct ExParseInt {
+    typedef T type;
+    static bool parse(const char *s, size_t len, T *v) {
+        if (S) {
+            int64_t x;
+            if ((!express_parse_i64(s, len, &x)) || (x < (int64_t)std::numeric_limits<T>::min()) || (x > (int64_t)std::numeric_limits<T>::max())) return false;
+            *v = (T)x;
+        } else {
+            uint64_t x;
+            if ((!express_parse_u64(s, len, &x, 0)) || (x > (uint64_t)std::numeric_limits<T>::max())) return false;
+            *v = (T)x;
+        }
+        return true;
+    }
+};
+template <typename T>
+struct ExParse : ExParseInt<T, std::numeric_limits<T>::is_signed> {
+    static_assert(std::numeric_limits<T>::is_integer, "ExParse: use integer, float, double, bool or ExHex");
+};
+template <> struct ExParse<ExHex> {
+    typedef uint32_t type;
+    static bool parse(const char *s, size_t len, uint32_t *v) {
+        uint64_t x;
+        if ((!express_parse_u64(s, len, &x, 16)) || (x > UINT32_MAX)) return false;
+        *v = (uint32_t)x;
+        return true;
+    }
+};
+template <> struct ExParse<double> {
+    typedef double type;
+    static bool parse(const char *s, size_t len, double *v) { return express_parse_double(s, len, v); }
+};
+template <> struct ExParse<float> {
+    typedef float type;
+    static bool parse(const char *s, size_t len, float *v) {
+        double d;
+        if (!express_parse_double(s, len, &d)) return false;
+        *v = (float)d;
+        return true;
+    }
+};
+template <> struct ExParse<bool> {
+    typedef bool type;
+    static bool parse(const char *s, size_t len, bool *v) { return express_parse_bool(s, len, v); }
+};
+
+#endif
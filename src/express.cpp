@@ -9,7 +9,9 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
+#include <ctype.h>
 #include <sys/param.h>
 
 #include "freertos/FreeRTOS.h"
@@ -49,6 +51,22 @@ static const char* TAG = "Express";
 #define msg_ota(fmt, args...)  ESP_LOGI(TAG, fmt, ## args);
 #endif
 
+/* const httpd related values stored in ROM */
+const static char http_200_hdr[] = "200 OK";
+const static char http_content_type_html[] = "text/html";
+const static char http_content_type_json[] = "application/manifest+json";
+const static char http_content_type_js[] = "text/javascript";
+const static char http_content_type_image[] = "image/png";
+const static char http_content_type_txt[] = "text/plain";
+const static char http_set_cookie[] = "Set-Cookie";
+const static char http_cookie[] = "Cookie";
+const static char http_content_type[] = "Content-Type";
+/* Fixed header lines of response profiles */
+const static char http_hdr_no_cache[] = "Cache-Control: no-store, no-cache, must-revalidate, max-age=0\r\nPragma: no-cache\r\n";
+const static char http_hdr_cache[] = "Cache-Control: public, max-age=31536000\r\n";
+const static char http_hdr_vary[] = "Vary: Accept-Encoding\r\n";
+const static char http_hdr_cache_gzip[] = "Cache-Control: public, max-age=31536000\r\nContent-Encoding: gzip\r\n";
+
 #define HTTP_CHUNK_SIZE      (4096)
 #define STATUS_JSON_MAX_SIZE (16384)
 
@@ -121,34 +139,10 @@ void Express::do_pm_unlock()
 //===========================================================================
 
 
-static esp_err_t express_post_handler(httpd_req_t* req)
-{
-    Express* e = (Express*)httpd_get_global_user_ctx(req->handle);
-    return e->doRQ(req, &e->m_post, &e->m_lpost);
-}
-
-static esp_err_t express_get_handler(httpd_req_t* req)
-{
-    Express* e = (Express*)httpd_get_global_user_ctx(req->handle);
-    return e->doRQ(req, &e->m_get, &e->m_lget);
-}
-
-static esp_err_t express_delete_handler(httpd_req_t* req)
-{
-    Express* e = (Express*)httpd_get_global_user_ctx(req->handle);
-    return e->doRQ(req, &e->m_delete, &e->m_ldelete);
-}
-
-static esp_err_t express_patch_handler(httpd_req_t* req)
+static esp_err_t express_rq_handler(httpd_req_t* req)
 {
     Express* e = (Express*)httpd_get_global_user_ctx(req->handle);
-    return e->doRQ(req, &e->m_patch, &e->m_lpatch);
-}
-
-static esp_err_t express_put_handler(httpd_req_t* req)
-{
-    Express* e = (Express*)httpd_get_global_user_ctx(req->handle);
-    return e->doRQ(req, &e->m_put, &e->m_lput);
+    return e->doRQ(req);
 }
 
 static esp_err_t express_ws_handler(httpd_req_t* req)
@@ -158,9 +152,13 @@ static esp_err_t express_ws_handler(httpd_req_t* req)
         return ESP_OK;
     } else {
         Express* e = (Express*)httpd_get_global_user_ctx(req->handle);
-        WSRequest r(req, e);
         esp_err_t ret;
 
+        /* Handlers run one at a time on httpd task - one frame buffer for all sockets */
+        if (!e->m_wsBuf) e->m_wsBuf = (uint8_t *)::malloc(WS_MAX_FRAME_SIZE);
+        if (!e->m_wsBuf) return ESP_ERR_NO_MEM;
+        WSRequest r(req, e, e->m_wsBuf);
+
         ret = httpd_ws_recv_frame(req, &r.m_pkt, WS_MAX_FRAME_SIZE);
         if (ret != ESP_OK) {
             msg_error("httpd_ws_recv_frame failed with %d", ret);
@@ -186,26 +184,22 @@ Express::Express()
     __ota_update_partition = NULL;
     __ota_update_handle = 0;
     __ota_start_timestamp = 0;
+    m_wsBuf = NULL;
+    m_txBuf = NULL;
 
     /* Fill handlers */
-    memset(&m_h_get, 0, sizeof(httpd_uri_t));
-    memset(&m_h_post, 0, sizeof(httpd_uri_t));
+    memset(&m_h_rq, 0, sizeof(httpd_uri_t));
     memset(&m_h_ws, 0, sizeof(httpd_uri_t));
-    memset(&m_h_delete, 0, sizeof(httpd_uri_t));
-    memset(&m_h_patch, 0, sizeof(httpd_uri_t));
-    memset(&m_h_put, 0, sizeof(httpd_uri_t));
-
-    m_h_get.uri = "*";
-    m_h_get.handler = express_get_handler;
-    m_h_get.user_ctx = (void*)this;
-    m_h_get.is_websocket = false;
-    m_h_get.method = HTTP_GET;
-
-    m_h_post.uri = "*";
-    m_h_post.handler = express_post_handler;
-    m_h_post.user_ctx = (void*)this;
-    m_h_post.is_websocket = false;
-    m_h_post.method = HTTP_POST;
+
+    m_h_rq.uri = "*";
+    m_h_rq.handler = express_rq_handler;
+    m_h_rq.user_ctx = (void*)this;
+    m_h_rq.is_websocket = false;
+#ifdef HTTP_ANY
+    m_h_rq.method = HTTP_ANY;
+#else
+    m_h_rq.method = HTTP_GET;
+#endif
 
     m_h_ws.uri = "/ws";
     m_h_ws.handler = express_ws_handler;
@@ -213,26 +207,10 @@ Express::Express()
     m_h_ws.is_websocket = true;
     m_h_ws.method = HTTP_GET;
 
-    m_h_delete.uri = "*";
-    m_h_delete.handler = express_delete_handler;
-    m_h_delete.user_ctx = (void*)this;
-    m_h_delete.is_websocket = false;
-    m_h_delete.method = HTTP_DELETE;
-
-    m_h_patch.uri = "*";
-    m_h_patch.handler = express_patch_handler;
-    m_h_patch.user_ctx = (void*)this;
-    m_h_patch.is_websocket = false;
-    m_h_patch.method = HTTP_PATCH;
-
-    m_h_put.uri = "*";
-    m_h_put.handler = express_put_handler;
-    m_h_put.user_ctx = (void*)this;
-    m_h_put.is_websocket = false;
-    m_h_put.method = HTTP_PUT;
-
     m_wsCB = NULL;
     m_onMissing = NULL;
+    m_frozen = false;
+    m_missChain = { 0, 0 };
 
     /* Generic API */
     get("api/mem", [](ExRequest* req) {
@@ -265,22 +243,22 @@ Express::Express()
 #endif
 #ifndef NO_EXPRESS_TASKLIST
     get("api/tasks", [](ExRequest* req) {
-        std::string ret;
         const size_t bytes_per_task = 40; /* see vTaskList description */
         char *task_list_buffer = (char *)malloc(uxTaskGetNumberOfTasks() * bytes_per_task);
         if (task_list_buffer == NULL) {
             msg_error("failed to allocate buffer for vTaskList output");
             return;
         }
+        ExResponseStream s(req);
 #ifdef CONFIG_FREERTOS_VTASKLIST_INCLUDE_COREID
-        ret = "Task Name\tStatus\tPrio\tHWM\tTask#\tAffinity\n";
+        s << "Task Name\tStatus\tPrio\tHWM\tTask#\tAffinity\n";
 #else
-        ret = "Task Name\tStatus\tPrio\tHWM\tTask#\n";
+        s << "Task Name\tStatus\tPrio\tHWM\tTask#\n";
 #endif
         vTaskList(task_list_buffer);
-        ret += std::string(task_list_buffer);
+        s << task_list_buffer;
         free(task_list_buffer);
-        req->txt((const char*)ret.c_str(), ret.length());
+        s.end();
     });
 #endif    
     /* OTA */
@@ -296,6 +274,8 @@ Express::~Express()
     if (m_pm_cpu_lock) esp_pm_lock_delete(m_pm_cpu_lock);
     if (m_pm_sleep_lock) esp_pm_lock_delete(m_pm_sleep_lock);
 #endif
+    ::free(m_wsBuf);
+    ::free(m_txBuf);
 }
 
 /*!
@@ -303,13 +283,7 @@ Express::~Express()
  */
 bool Express::hasMeta(const char *a) const
 {
-    const char *ch = a;
-    while (*ch != '\0') {
-        /* Check for meta characters */
-        if ((*ch == '*') || (*ch == ':') || (*ch == '#')) return true;
-        ch++;
-    }
-    return false;
+    return ExRouteTable::hasMeta(a);
 }
 
 /*!
@@ -317,23 +291,180 @@ bool Express::hasMeta(const char *a) const
  */
 bool Express::comparePath(const char *a, const char *b) const
 {
-    if (*a == '\0') return true;
-	while ((*a != '\0') && (*b != '\0')) {
-        if (*a == '#') return true;
-		if ((*a == '*') || (*a == ':')) {
-			/* Skip section */
-			while ((*a != '/') && (*a != '\0')) a++;
-			while ((*b != '/') && (*b != '\0')) b++;
-		}
-		if ((*a == '\0') || (*b == '\0')) break;
-		if (*a != *b) return false;		
-		a++;
-		b++;
-	}
-	if ((*a != '\0') || (*b != '\0')) return false;
-    return true;
+    return ExRouteTable::comparePath(a, b);
+}
+
+
+/*!
+ * \brief Add page.
+ * \param path    - page path,
+ * \param methods - accepted methods (EXPRESS_GET | EXPRESS_POST ...),
+ * \param m, n    - page middlewares (executed after global ones),
+ * \param cb      - page callback.
+ */
+void ExRouter::route(const char* path, uint32_t methods, const ExpressMidCB *m, size_t n, ExpressPageCB cb)
+{
+    if (m_frozen) {
+        msg_error("Route %s registered after start - ignored", path);
+        return;
+    }
+    m_pages.add(path, methods, m, n, cb);
 }
 
+/*!
+ * \brief Add middleware (empty path = execute for any path).
+ */
+void ExRouter::use(const char* path, ExpressMidCB cb)
+{
+    if (m_frozen) {
+        msg_error("Middleware %s registered after start - ignored", path);
+        return;
+    }
+    if (*path == '\0') m_midAll.push_back({ path, cb }); else m_mid.push_back({ path, cb });
+}
+
+/*!
+ * \brief Set max body size of pages registered with path.
+ */
+void ExRouter::bodyLimit(const char* path, size_t max)
+{
+    bool found = false;
+
+    while (*path == '/') path++;
+    for (size_t i = 0; i < m_pages.cb.size(); ++i) {
+        const char *p = m_pages.routes.path(i);
+        while (*p == '/') p++;
+        if (strcmp(p, path)) continue;
+        m_pages.limit[i] = max;
+        found = true;
+    }
+    if (!found) msg_error("Body limit: route %s not registered", path);
+}
+
+/*!
+ * \brief Mount router under prefix.
+ */
+void ExRouter::mount(const char* prefix, ExRouter &r)
+{
+    if (m_frozen) {
+        msg_error("Router %s mounted after start - ignored", prefix);
+        return;
+    }
+    m_mounts.push_back({ prefix, &r, m_pages.cb.size() });
+}
+
+/*!
+ * \brief Join prefix and path (result is kept until Express is destroyed).
+ */
+const char *Express::joinPath(const std::string &prefix, const char *path)
+{
+    std::string s = prefix;
+    while (*path == '/') path++;
+    while ((s.length()) && (s.back() == '/')) s.pop_back();
+    if (*path != '\0') {
+        if (s.length()) s += '/';
+        s += path;
+    }
+    m_paths.push_back(s);
+    return m_paths.back().c_str();
+}
+
+/*!
+ * \brief Copy pages of mounted router (and its sub routers) into Express route table.
+ *   The trie shares the prefix nodes, so the prefix is compared once per request.
+ */
+void Express::flatten(ExRouter *r, const std::string &prefix, int parent)
+{
+    int s = m_scopes.size();
+    const ExpressPgTable &t = r->m_pages;
+
+    m_scopes.push_back({ parent, {} });
+    /* Router-wide middlewares apply to every page of the router (and its sub routers).
+     * Callbacks are copied (like page middlewares), router may be destroyed after start. */
+    for (const auto &m : r->m_midAll) {
+        m_mountMid.push_back(m.second);
+        m_scopes[s].mid.push_back({ joinPath(prefix, ""), &m_mountMid.back(), false, true });
+    }
+    for (const auto &m : r->m_mid) {
+        m_mountMid.push_back(m.second);
+        m_scopes[s].mid.push_back({ joinPath(prefix, m.first), &m_mountMid.back(), true, false });
+    }
+    addPages(r, r->m_pages, prefix, s);
+    r->m_frozen = true;
+}
+
+/*!
+ * \brief Add pages of router (scope s) to Express route table, mounted routers at their mount position.
+ *   Route id is the priority of overlapping routes, so the first registered route wins across routers too.
+ */
+void Express::addPages(const ExRouter *r, const ExpressPgTable &t, const std::string &prefix, int s)
+{
+    auto m = r->m_mounts.begin();
+
+    for (size_t i = 0; i <= t.cb.size(); ++i) {
+        for (; (m != r->m_mounts.end()) && (m->at == i); ++m) flatten(m->router, joinPath(prefix, m->prefix), s);
+        if (i == t.cb.size()) break;
+        const ExpressChain &l = t.local[i];
+        const char *path = prefix.empty() ? t.routes.path(i) : joinPath(prefix, t.routes.path(i));
+        m_pages.add(path, t.routes.methods(i), t.mid.data() + l.first, l.count, t.cb[i], s, t.limit[i]);
+    }
+}
+
+/*!
+ * \brief Freeze configuration (precompute middleware chain for every route).
+ */
+void Express::freeze()
+{
+    std::vector<int> scopes;
+
+    if (m_frozen) return;
+    m_chain.clear();
+    m_scopes.clear();
+
+    /* Express middlewares (scope 0) */
+    m_scopes.push_back({ -1, {} });
+    for (const auto &m : m_midAll) m_scopes[0].mid.push_back({ m.first, &m.second, false, false });
+    for (const auto &m : m_mid) m_scopes[0].mid.push_back({ m.first, &m.second, true, false });
+    /* Own pages are added again with mounted routers in between (at their mount position) */
+    {
+        ExpressPgTable own;
+        std::swap(own, m_pages);
+        addPages(this, own, "", 0);
+    }
+    m_pages.chain.resize(m_pages.cb.size());
+
+    /* Not found pages - path and router scope checked at runtime */
+    m_missChain.first = m_chain.size();
+    for (size_t s = 0; s < m_scopes.size(); ++s) {
+        for (const auto &m : m_scopes[s].mid) m_chain.push_back(m);
+    }
+    m_missChain.count = m_chain.size() - m_missChain.first;
+
+    for (size_t i = 0; i < m_pages.cb.size(); ++i) {
+        const char *path = m_pages.routes.path(i);
+        ExpressChain &c = m_pages.chain[i];
+        c.first = m_chain.size();
+        /* Scopes from Express to router of this page (router-wide middlewares always apply) */
+        scopes.clear();
+        for (int s = m_pages.scope[i]; s >= 0; s = m_scopes[s].parent) scopes.push_back(s);
+        for (auto s = scopes.rbegin(); s != scopes.rend(); ++s) {
+            for (const auto &m : m_scopes[*s].mid) {
+                ExRouteCover v = m.check ? ExRouteTable::covers(m.path, path) : ExRouteCoverAlways;
+                if (v != ExRouteCoverNever) m_chain.push_back({ m.path, m.cb, (v == ExRouteCoverMaybe), false });
+            }
+        }
+        /* Page middlewares */
+        const ExpressChain &l = m_pages.local[i];
+        for (int j = l.first; j < (l.first + l.count); ++j) m_chain.push_back({ path, &m_pages.mid[j], false, false });
+        c.count = m_chain.size() - c.first;
+    }
+#ifdef CONFIG_EXPRESS_USE_METRICS
+    /* Counters for every route + not found */
+    for (auto &t : m_stats) t.assign(m_pages.cb.size() + 1, ExpressRouteStats());
+#endif
+    m_frozen = true;
+    msg_info("Routes: %d, middleware chain size: %d", (int)m_pages.cb.size(), (int)m_chain.size());
+}
 
 /*!
  * \brief Start http server.
@@ -343,7 +474,6 @@ bool Express::comparePath(const char *a, const char *b) const
  */
 void Express::start(int port, uint8_t pr, BaseType_t coreID)
 {
-    std::map<const char*, ExpressPageCB, ExRequest_cmp_str>::iterator i;
     m_config = HTTPD_DEFAULT_CONFIG();
 
     /* LOCK core ID for HTTP server */
@@ -358,19 +488,25 @@ void Express::start(int port, uint8_t pr, BaseType_t coreID)
     m_config.lru_purge_enable = true;
     m_config.stack_size = 16 * 1024;
 
-    // for (i = m_get.begin(); i != m_get.end(); ++i) {
-    //     msg_debug("GET <%s>", i->first);
-    // }
+    freeze();
 
     msg_info("Starting server on port: '%d'", m_config.server_port);
     if (httpd_start(&m_server, &m_config) == ESP_OK) {
         msg_info("Registering URI handlers");
         httpd_register_uri_handler(m_server, &m_h_ws);
-        httpd_register_uri_handler(m_server, &m_h_get);
-        httpd_register_uri_handler(m_server, &m_h_post);
-        httpd_register_uri_handler(m_server, &m_h_delete);
-        httpd_register_uri_handler(m_server, &m_h_patch);
-        httpd_register_uri_handler(m_server, &m_h_put);
+#ifdef HTTP_ANY
+        /* One catch-all handler, method is resolved by the route table */
+        httpd_register_uri_handler(m_server, &m_h_rq);
+#else
+        /* No HTTP_ANY in this IDF version - register the same handler for every method */
+        {
+            const httpd_method_t methods[] = { HTTP_GET, HTTP_POST, HTTP_DELETE, HTTP_PATCH, HTTP_PUT };
+            for (auto m : methods) {
+                m_h_rq.method = m;
+                httpd_register_uri_handler(m_server, &m_h_rq);
+            }
+        }
+#endif
         return;
     }
     msg_error("Error starting server!");
@@ -378,79 +514,259 @@ void Express::start(int port, uint8_t pr, BaseType_t coreID)
 
 
 const static char http_404_hdr[] = "404 Not Found";
+const static char http_405_hdr[] = "405 Method Not Allowed";
 const static char http_401_hdr[] = "401 Unauthorized";
+const static char http_413_hdr[] = "413 Payload Too Large";
+const static char http_411_hdr[] = "411 Length Required";
+
 /*!
- * \brief Handle GET (HTML/CSS/JS/JSON code).
+ * \brief Build Allow header value from method mask.
  */
-esp_err_t Express::doRQ(httpd_req_t* req, ExpressPgMap* m, ExpressPgList *l)
+static void express_allow_str(uint32_t mask, char *buf, size_t size)
 {
-    ExRequest rq(req, this);
-    esp_err_t ret = ESP_OK;
+    static const struct { uint32_t m; const char *n; } names[] = {
+        { EXPRESS_GET, "GET" }, { EXPRESS_POST, "POST" }, { EXPRESS_PUT, "PUT" },
+        { EXPRESS_PATCH, "PATCH" }, { EXPRESS_DELETE, "DELETE" }
+    };
+    size_t l = 0;
+
+    buf[0] = '\0';
+    for (const auto &n : names) {
+        if (mask & n.m) l += snprintf(buf + l, size - l, "%s%s", l ? ", " : "", n.n);
+        if (l >= size) break;
+    }
+}
+
+/*!
+ * \brief Handle request (HTML/CSS/JS/JSON code).
+ */
+esp_err_t Express::doRQ(httpd_req_t* req)
+{
+    esp_err_t ret;
+    /* Previous request is finished - reuse its memory */
+    m_arena.reset();
+    ExRequest rq(req, this, &m_arena);
+#ifdef CONFIG_EXPRESS_USE_METRICS
+    int64_t t = esp_timer_get_time();
+#endif
     do_pm_lock();
+    /* Find page in route trie */
+    int id = m_pages.routes.match(rq.m_uri, rq.m_uri_len, EXPRESS_METHOD(req->method), &rq.m_params);
+    ret = dispatch(rq, id);
+    /* Unread chunked body would be parsed as next request */
+    if (rq.body().leftover()) httpd_sess_trigger_close(m_server, httpd_req_to_sockfd(req));
+    do_pm_unlock();
+#ifdef CONFIG_EXPRESS_USE_METRICS
+    count(id, rq, ret, esp_timer_get_time() - t);
+#endif
+    return ret;
+}
+
+/*!
+ * \brief Check if request path belongs to router mounted at prefix (prefix itself or below it).
+ */
+static bool express_in_scope(const char *prefix, const char *uri, size_t len)
+{
+    size_t n = strlen(prefix);
+
+    if ((n > len) || (memcmp(prefix, uri, n) != 0)) return false;
+    return (n == 0) || (n == len) || (uri[n] == '/');
+}
 
-    /* Middleware - phase1 (mach to all pages) */
+/*!
+ * \brief Execute middlewares and page (or 405/404).
+ */
+esp_err_t Express::dispatch(ExRequest &rq, int id)
+{
+    /* Route body limit - 413 before any middleware reads the body */
+    if ((id >= 0) && (m_pages.limit[id])) {
+        rq.body().setLimit(m_pages.limit[id]);
+        if (!rq.body().check()) return ESP_OK;
+    }
+    /* Middleware (precomputed chain for the page) */
     {
-        auto itr1 = m_midAll.cbegin();
-        while (itr1 != m_midAll.cend()) {
-            rq.setKey(itr1->first);
-            if (!itr1->second(&rq)) {
-                do_pm_unlock();
-                return ret;
-            }
-            itr1++;
+        const ExpressChain &c = (id >= 0) ? m_pages.chain[id] : m_missChain;
+        const ExpressMidRef *m = m_chain.data() + c.first, *e = m + c.count;
+        for (; m != e; ++m) {
+            if ((m->check) && (!ExRouteTable::comparePath(m->path, rq.m_uri, rq.m_uri + rq.m_uri_len))) continue;
+            if ((m->scope) && (!express_in_scope(m->path, rq.m_uri, rq.m_uri_len))) continue;
+            rq.setKey(m->path);
+            if (!(*m->cb)(&rq)) return ESP_OK;
         }
+    }
 
-        /* Middleware - phase2 (selective match) */
-        itr1 = m_mid.cbegin();
-        while (itr1 != m_mid.cend()) {
-            if (comparePath(itr1->first, rq.uri())) {
-                rq.setKey(itr1->first);
-                if (!itr1->second(&rq)) {
-                    do_pm_unlock();
-                    return ret;
-                }
-            }
-            itr1++;
-        }    
+    /* Call page */
+    if (id >= 0) {
+        rq.setKey(m_pages.routes.path(id));
+        m_pages.cb[id](&rq);
+        return ESP_OK;
+    }
+    /* Path exists but not for this method */
+    if (rq.m_params.allow) {
+        char allow[40];
+        express_allow_str(rq.m_params.allow, allow, sizeof(allow));
+        rq.setStatus(http_405_hdr);
+        rq.setHeader("Allow", allow);
+        return rq.sendAll(NULL, 0);
     }
+    if (m_onMissing) {
+        if (m_onMissing(&rq)) return ESP_OK;
+    }
+    /* Not found */
+    rq.setStatus(http_404_hdr);
+    return rq.sendAll(NULL, 0);
+}
 
-    /* Find page in map */
-    {
-        auto i = m->find(rq.uri());
-        if (i != m->end()) {
-            rq.setKey(i->first);
-            i->second(&rq);
-            do_pm_unlock();
-            return ret;
+#ifdef CONFIG_EXPRESS_USE_METRICS
+/*!
+ * \brief Register metrics pages (JSON and Prometheus text, protect them with use() if needed).
+ */
+void Express::addMetrics(const char *jsonPath, const char *promPath)
+{
+    get(jsonPath, [](ExRequest* req) {
+        std::string json = req->m_e->metricsJSON();
+        req->json(json.c_str(), json.length());
+    });
+    get(promPath, [](ExRequest* req) {
+        std::string txt = req->m_e->metricsPrometheus();
+        req->send("text/plain; version=0.0.4", txt.c_str(), txt.length());
+    });
+}
+
+/*!
+ * \brief Update route counters of the current core (no locks - only httpd task writes them).
+ */
+void Express::count(int id, const ExRequest &rq, esp_err_t ret, int64_t us)
+{
+    std::vector<ExpressRouteStats> &v = m_stats[xPortGetCoreID()];
+    size_t i = (id >= 0) ? (size_t)id : m_pages.cb.size();
+    uint32_t d = (us > 0) ? (uint32_t)((us - 1) >> 8) : 0;
+    int b = 0;
+
+    if (i >= v.size()) return;
+    ExpressRouteStats &s = v[i];
+    /* Bucket = log2(us / 256) */
+    while ((d) && (b < (EXPRESS_METRICS_BUCKETS - 1))) { d >>= 1; b++; }
+    s.hits++;
+    if ((rq.m_failed) || (ret != ESP_OK)) s.errors++;
+    s.bytes += rq.m_sent;
+    s.time_us += us;
+    s.hist[b]++;
+}
+
+/*!
+ * \brief Sum route counters of all cores.
+ */
+void Express::sumStats(size_t id, ExpressRouteStats &t) const
+{
+    memset(&t, 0, sizeof(t));
+    for (const auto &v : m_stats) {
+        if (id >= v.size()) continue;
+        const ExpressRouteStats &s = v[id];
+        t.hits    += s.hits;
+        t.errors  += s.errors;
+        t.bytes   += s.bytes;
+        t.time_us += s.time_us;
+        for (int b = 0; b < EXPRESS_METRICS_BUCKETS; ++b) t.hist[b] += s.hist[b];
+    }
+}
+
+/*!
+ * \brief Route metrics as JSON (routes without hits are skipped).
+ *   { "buckets_us": [256, 512, ...], "routes": [ { "path": "api/mem", "hits": 1, "errors": 0, "bytes": 30, "time_us": 420, "hist": [0, 1, ...] }, ... ] }
+ */
+std::string Express::metricsJSON()
+{
+    std::string r = "{ \"buckets_us\": [";
+    char buf[96];
+    bool first = true;
+
+    for (int b = 0; b < (EXPRESS_METRICS_BUCKETS - 1); ++b) {
+        snprintf(buf, sizeof(buf), "%s%u", b ? "," : "", 256U << b);
+        r += buf;
+    }
+    r += "], \"routes\": [";
+    for (size_t i = 0; i <= m_pages.cb.size(); ++i) {
+        ExpressRouteStats t;
+        sumStats(i, t);
+        if (!t.hits) continue;
+        r += first ? "{ \"path\": \"" : ",{ \"path\": \"";
+        r += (i < m_pages.cb.size()) ? m_pages.routes.path(i) : "(miss)";
+        snprintf(buf, sizeof(buf), "\", \"hits\": %u, \"errors\": %u, \"bytes\": %llu, \"time_us\": %llu, \"hist\": [",
+            (unsigned)t.hits, (unsigned)t.errors, (unsigned long long)t.bytes, (unsigned long long)t.time_us);
+        r += buf;
+        for (int b = 0; b < EXPRESS_METRICS_BUCKETS; ++b) {
+            snprintf(buf, sizeof(buf), "%s%u", b ? "," : "", (unsigned)t.hist[b]);
+            r += buf;
         }
+        r += "] }";
+        first = false;
     }
+    r += "] }";
+    return r;
+}
 
-    /* Find page in list */
-    {
-        auto i = l->cbegin();
-        while (i != l->cend()) {
-            if (comparePath(i->first, rq.uri())) {
-                rq.setKey(i->first);
-                i->second(&rq);
-                do_pm_unlock();
-                return ret;
-            }
-            i++;
+/*!
+ * \brief Route metrics in Prometheus text format (routes without hits are skipped).
+ *   Every family (TYPE line and its samples) is one contiguous group.
+ */
+std::string Express::metricsPrometheus()
+{
+    std::vector<ExpressRouteStats> st;
+    std::vector<std::string> lbl;
+    std::string r;
+    char buf[128];
+
+    /* Sum cores once, label of every route with hits */
+    for (size_t i = 0; i <= m_pages.cb.size(); ++i) {
+        ExpressRouteStats t;
+        sumStats(i, t);
+        if (!t.hits) continue;
+        std::string l = "{route=\"";
+        for (const char *p = (i < m_pages.cb.size()) ? m_pages.routes.path(i) : "(miss)"; *p; ++p) {
+            if ((*p == '"') || (*p == '\\')) l += '\\';
+            l += *p;
         }
+        l += "\"";
+        st.push_back(t);
+        lbl.push_back(l);
     }
-    if (m_onMissing) {
-        if (m_onMissing(&rq)) {
-            do_pm_unlock();
-            return ret;            
+    r = "# TYPE express_requests_total counter\n";
+    for (size_t i = 0; i < st.size(); ++i) {
+        snprintf(buf, sizeof(buf), "} %u\n", (unsigned)st[i].hits);
+        r += "express_requests_total" + lbl[i] + buf;
+    }
+    r += "# TYPE express_errors_total counter\n";
+    for (size_t i = 0; i < st.size(); ++i) {
+        snprintf(buf, sizeof(buf), "} %u\n", (unsigned)st[i].errors);
+        r += "express_errors_total" + lbl[i] + buf;
+    }
+    r += "# TYPE express_response_bytes_total counter\n";
+    for (size_t i = 0; i < st.size(); ++i) {
+        snprintf(buf, sizeof(buf), "} %llu\n", (unsigned long long)st[i].bytes);
+        r += "express_response_bytes_total" + lbl[i] + buf;
+    }
+    r += "# TYPE express_request_duration_seconds histogram\n";
+    for (size_t i = 0; i < st.size(); ++i) {
+        const ExpressRouteStats &t = st[i];
+        uint32_t c = 0;
+        for (int b = 0; b < EXPRESS_METRICS_BUCKETS; ++b) {
+            c += t.hist[b];
+            if (b < (EXPRESS_METRICS_BUCKETS - 1)) {
+                snprintf(buf, sizeof(buf), ",le=\"%.6f\"} %u\n", (double)(256U << b) / 1000000.0, (unsigned)c);
+            } else {
+                snprintf(buf, sizeof(buf), ",le=\"+Inf\"} %u\n", (unsigned)c);
+            }
+            r += "express_request_duration_seconds_bucket" + lbl[i] + buf;
         }
+        snprintf(buf, sizeof(buf), "} %.6f\n", (double)t.time_us / 1000000.0);
+        r += "express_request_duration_seconds_sum" + lbl[i] + buf;
+        snprintf(buf, sizeof(buf), "} %u\n", (unsigned)t.hits);
+        r += "express_request_duration_seconds_count" + lbl[i] + buf;
     }
-    /* Not found */
-    httpd_resp_set_status(req, http_404_hdr);
-    ret = httpd_resp_send(req, NULL, 0);
-    
-    do_pm_unlock();
-    return ret;
+    return r;
 }
+#endif
 
 /*!
  * \brief Add static files.
@@ -465,16 +781,53 @@ void Express::addStatic(struct www_file_t *f)
     l = strlen(f[i].name);
     while (l) {
         n = &f[i];
-        if (n->gz) {
-            get(n->name, [n](ExRequest* req) { req->gzip(n->mime_type, n->data, n->size); });
+        if ((n->br) || (n->identity)) {
+            /* More encodings - head per variant, chosen per request */
+            m_static.emplace_back();
+            ExStaticFile *s = &m_static.back();
+            s->br = staticVariant(n->mime_type, "br", n->br, n->br_size);
+            s->gzip = staticVariant(n->mime_type, "gzip", n->gz ? n->data : NULL, n->size);
+            if (n->gz) s->identity = staticVariant(n->mime_type, NULL, n->identity, n->identity_size);
+            else s->identity = staticVariant(n->mime_type, NULL, n->data, n->size);
+            get(n->name, [s](ExRequest* req) { req->sendStatic(*s); });
         } else {
-            get(n->name, [n](ExRequest* req) { req->send(n->mime_type, n->data, n->size); });
+            /* Response head is shared by files of the same type */
+            const ExResponseProfile *p = staticProfile(n->mime_type, n->gz ? http_hdr_cache_gzip : http_hdr_cache);
+            get(n->name, [n, p](ExRequest* req) { req->respond(*p, n->data, n->size); });
         }
         i++;
         l = strlen(f[i].name);
     }
 }
 
+/*!
+ * \brief Response head of static files (one profile per Content-Type and headers).
+ */
+const ExResponseProfile *Express::staticProfile(const char *type, const char *headers)
+{
+    ExResponseProfile p(http_200_hdr, type, headers);
+
+    for (const ExResponseProfile &i : m_profiles) {
+        if ((i.size() == p.size()) && (memcmp(i.head(), p.head(), p.size()) == 0)) return &i;
+    }
+    m_profiles.push_back(std::move(p));
+    return &m_profiles.back();
+}
+
+/*!
+ * \brief Build head of static file variant (coding NULL = identity).
+ */
+ExStaticVariant Express::staticVariant(const char *type, const char *coding, const char *data, int size)
+{
+    ExStaticVariant v = { NULL, data, size };
+    std::string h(http_hdr_cache);
+
+    if (!data) return v;
+    if (coding) h.append("Content-Encoding: ").append(coding).append("\r\n");
+    h.append(http_hdr_vary);
+    v.head = staticProfile(type, h.c_str());
+    return v;
+}
 
 /*!
  * \brief Handle websocket message (API).
@@ -636,6 +989,44 @@ esp_err_t Express::ota_stop(uint32_t abort)
 }
 /* ========================================================================================== */
 
+bool ExOtaSink::begin(const ExMultipartPart &p)
+{
+    Express *e = m_e;
+
+    (void)p; /* Only used by msg_ota (may compile to nothing) */
+    if (e->ota_stop(2) != ESP_OK) return false;
+    msg_ota("OTA upload %s", p.filename);
+    e->__ota_start_timestamp = esp_timer_get_time();
+    e->__ota_update_partition = esp_ota_get_next_update_partition(NULL);
+    e->__ota_cnt = 0;
+    e->__ota_size = 0;
+    if (esp_ota_begin(e->__ota_update_partition, OTA_WITH_SEQUENTIAL_WRITES, &e->__ota_update_handle) != ESP_OK) return false;
+    e->__ota_active = 1;
+    m_active = true;
+    return true;
+}
+
+bool ExOtaSink::write(const char *data, size_t len)
+{
+    if (esp_ota_write(m_e->__ota_update_handle, (const void*)data, len) != ESP_OK) return false;
+    m_e->__ota_cnt += len;
+    return true;
+}
+
+bool ExOtaSink::end()
+{
+    m_active = false;
+    m_e->__ota_size = m_e->__ota_cnt;
+    m_ok = (m_e->ota_stop(0) == ESP_OK);
+    return m_ok;
+}
+
+void ExOtaSink::abort()
+{
+    if (m_active) m_e->ota_stop(1);
+    m_active = false;
+}
+
 /*!
  * \brief Handle POST buffer (FIRMWARE update).
  */
@@ -720,7 +1111,7 @@ std::string Express::generateUUID()
     v[6] = esp_random();
     v[7] = esp_random();
     /* Dummy for pad*/
-    v[8] = (uint32_t)this;
+    v[8] = (uint32_t)(uintptr_t)this;
     mbedtls_base64_encode((unsigned char *)&sid[0], 64, &olen, (const unsigned char *)&v[0], 33 );
     sid.resize(olen);
     // msg_error("olen = %d, string len = %d, ssid = %s", olen, sid.length(), sid.c_str());
@@ -762,16 +1153,17 @@ ExpressMidCB Express::getSessionMW(int maxAge)
 		    this->cleanupOutdatedSessions();
 		    /* Generate new session ID */
             std::string uuid = generateUUID();
-		    req->m_user["sessionid"] = uuid;
-		    req->m_user["cookie"] = "SessionID=" + uuid + "; Max-Age=" + std::to_string(maxAge);
-		    req->setCookie(req->m_user["cookie"].c_str());
+            std::string cookie = "SessionID=" + uuid + "; Max-Age=" + std::to_string(maxAge);
+		    req->ctx<ExSessionId>() = req->m_arena->strdup(uuid.c_str());
+		    req->ctx<ExSessionCookie>() = req->m_arena->strdup(cookie.c_str());
+		    req->setCookie(req->ctx<ExSessionCookie>());
 		    msg_debug("Generate new session ID: %s", uuid.c_str());
 	    } else {
-            /* Store session ID from cookie */
-            std::string sid = std::string(sessionID);
-		    msg_debug("Got session ID: %s", sid.c_str());
-		    req->m_user["sessionid"] = sid;
-            req->m_session = m_sessions[sid];
+            /* Store session ID from cookie (cookie table lives in ExSockCtx arena of the connection) */
+		    msg_debug("Got session ID: %s", sessionID);
+		    req->ctx<ExSessionId>() = sessionID;
+            auto s = m_sessions.find(sessionID);
+            req->m_session = (s != m_sessions.end()) ? s->second : NULL;
 	    }
 	    return true;
     };
@@ -791,7 +1183,8 @@ ExpressMidCB Express::getWithAuthMW()
 			    return true;		
 		    }
 		    /* Delete session */
-		    m_sessions.erase(req->m_user["sessionid"]);
+		    const char **sid = req->findCtx<ExSessionId>();
+		    if (sid) m_sessions.erase(*sid);
             req->m_session = NULL;
 		    delete s;
 	    }
@@ -805,10 +1198,10 @@ ExpressMidCB Express::getWithAuthMW()
 bool Express::doLogin(ExRequest* req, std::string user)
 {
     /* Create new session */
-    std::string sid = req->m_user["sessionid"];
-    if (sid.length()) {
+    const char **sid = req->findCtx<ExSessionId>();
+    if ((sid) && (**sid)) {
         ExpressSession *s = new ExpressSession(user);
-        m_sessions[sid] = s;
+        m_sessions[*sid] = s;
         req->m_session = s; 
         return true;
     }
@@ -817,10 +1210,12 @@ bool Express::doLogin(ExRequest* req, std::string user)
 
 void Express::doLogOut(ExRequest* req)
 {
-    std::string sid = req->m_user["sessionid"];
-	ExpressSession *s = m_sessions[sid];	
+    const char **sid = req->findCtx<ExSessionId>();
+    if (!sid) return;
+    auto i = m_sessions.find(*sid);
+	ExpressSession *s = (i != m_sessions.end()) ? i->second : NULL;
 	if (s) {
-		m_sessions.erase(sid);
+		m_sessions.erase(i);
         req->m_session = NULL;
 		delete s;
 	}
@@ -866,9 +1261,12 @@ ExpressMidCB Express::getJsonMW()
 {
     return [this](ExRequest* req) {
         if (req->getMethod() == HTTP_GET) return true;
-        if (req->getContentLen() <= 0 ) return true;
-        if (req->getContentType().find("json") == std::string::npos) return true;
-        req->m_json = njson::parse(req->readAll().c_str());
+        if ((req->getContentLen() <= 0) && (!req->body().chunked())) return true;
+        if (!req->headers().contentType().contains("json")) return true;
+        std::string s = req->readAll();
+        /* 413/411 already sent */
+        if (req->body().failed()) return false;
+        req->m_json = njson::parse(s.c_str());
 	    return true;
     };
 }
@@ -878,224 +1276,251 @@ ExpressMidCB Express::getJsonMW()
 //======================--- Request/Response  ---============================
 //===========================================================================
 
-typedef enum {
-    cgi_load_key,
-    cgi_load_value
-} cgi_load_t;
+/*!
+ * \brief Store key/value in request table (first one wins on lookup).
+ */
+static void express_kv_insert(void *ctx, const char *key, const char *val, const char *raw, size_t raw_len)
+{
+    ((ExRequestMap *)ctx)->add(key, val, raw, raw_len);
+}
 
+/*!
+ * \brief Shared empty JSON document (copy on write - no allocation per request).
+ */
+const njson &ExRequest::nullJson()
+{
+    static const njson n;
+    return n;
+}
+
+/*!
+ * \brief Split uri into path view and query string (nothing is copied).
+ */
 void ExRequest::parseURI()
 {
-    const char* key = NULL, * value = NULL;
-    cgi_load_t load;
-    int len, i;
-    char* qr;
-
-    len = strlen(m_url);
-
-    load = cgi_load_key;
-    key = qr = m_url;
-    // enumerate string characters
-    for (i = 0;i < len;++i) {
-        switch (qr[i]) {
-            case '?': {
-                qr[i] = '\0';
-                value = NULL;
-                key = &qr[i + 1];
-            } break;
-            case '=': {
-                load = cgi_load_value;
-                qr[i] = '\0';
-                value = &qr[i + 1];
-            } break;
-            case ';':
-            case '&': {
-                if (load == cgi_load_key) {
-                    key = &qr[i + 1];
-                    value = NULL;
-                } else {
-                    qr[i] = '\0';
-                    load = cgi_load_key;
-                    if ((key) && (value)) {
-                        /* process key/value */
-                        m_query.insert({ key, value });
-                    }
-                    key = &qr[i + 1];
-                    value = NULL;
-                }
-            } break;
-            default: break;
-        }
-    }
-    if ((key) && (value)) {
-        /* process key/value */
-        m_query.insert({ key, value });
+    const char *p = m_req->uri, *e;
+
+    while (*p == '/') p++;
+    for (e = p; (*e != '\0') && (*e != '?'); ++e);
+    m_qs = (*e == '?') ? e + 1 : NULL;
+    m_uri = p;
+    m_uri_len = e - p;
+    if (m_uri_len == 0) {
+        m_uri = "index.html";
+        m_uri_len = 10;
     }
-    m_uri = m_url;
-    while (*m_uri == '/') m_uri++;
-    if (strlen(m_uri) == 0) m_uri = "index.html";
 }
 
+/*!
+ * \brief Parse query string (on first getArg).
+ */
+void ExRequest::parseQuery()
+{
+    m_query_parsed = true;
+    if (!m_qs) return;
+    size_t len = strlen(m_qs);
+    /* Decode into arena, raw values stay in httpd buffer */
+    char *q = (char *)m_arena->alloc(len + 1, 1);
+    if (q) express_parse_query(m_qs, q, len, express_kv_insert, &m_query);
+}
+
+/*!
+ * \brief Undecoded value as NUL terminated string.
+ */
+const char *ExRequest::rawValue(const ExKV *kv)
+{
+    if (!kv) return NULL;
+    if (kv->raw[kv->raw_len] == '\0') return kv->raw;
+    return m_arena->strndup(kv->raw, kv->raw_len);
+}
 
-/* const httpd related values stored in ROM */
-const static char http_200_hdr[] = "200 OK";
-const static char http_content_type_html[] = "text/html";
-const static char http_content_type_json[] = "application/manifest+json";
-const static char http_content_type_js[] = "text/javascript";
-const static char http_content_type_image[] = "image/png";
-const static char http_cache_control_hdr[] = "Cache-Control";
-const static char http_cache_control_cache[] = "public, max-age=31536000";
-const static char http_cache_control_no_cache[] = "no-store, no-cache, must-revalidate, max-age=0";
-const static char http_pragma_hdr[] = "Pragma";
-const static char http_pragma_no_cache[] = "no-cache";
-const static char http_content_type_txt[] = "text/plain";
-const static char http_set_cookie[] = "Set-Cookie";
-const static char http_cookie[] = "Cookie";
-const static char http_content_type[] = "Content-Type";
 
 
-std::string ExRequest::getHeader(const char *key) const
+/* Prefetched headers (order of ExHeaders fields) */
+static const char *const express_common_hdr[ExHeaders::Count] = { http_content_type, http_cookie, "Accept-Encoding", "If-None-Match", "Authorization" };
+
+/*!
+ * \brief Copy header value into request arena (empty span when missing).
+ */
+ExSpan ExRequest::fetchHeader(const char *key) const
 {
-    size_t len;
-    len = httpd_req_get_hdr_value_len(m_req, key);    
-    if (len > 0) {    
-        std::string res(len, 0);
-        httpd_req_get_hdr_value_str(m_req, key, &res[0], len + 1);
-        return res;
+    static const char empty[] = "";
+    size_t len = httpd_req_get_hdr_value_len(m_req, key);
+    char *b;
+
+    if ((len == 0) || (!(b = (char *)m_arena->alloc(len + 1, 1)))) return { empty, 0 };
+    if (httpd_req_get_hdr_value_str(m_req, key, b, len + 1) != ESP_OK) return { empty, 0 };
+    return { b, len };
+}
+
+/*!
+ * \brief Get common header (fetched from httpd on first access).
+ */
+const ExSpan &ExHeaders::get(Id id) const
+{
+    if (!(m_ready & (1 << id))) {
+        m_v[id] = m_rq->fetchHeader(express_common_hdr[id]);
+        m_ready |= (1 << id);
     }
-    return std::string();  
+    return m_v[id];
 }
 
-std::string ExRequest::getContentType() const
+int ExHeaders::find(const char *key)
 {
-    return getHeader(http_content_type);
+    for (int i = 0; i < Count; ++i) {
+        if (strcasecmp(key, express_common_hdr[i]) == 0) return i;
+    }
+    return -1;
 }
 
+/*!
+ * \brief Get header value (common headers come from headers(), others are copied into arena).
+ */
+ExSpan ExRequest::getHeaderView(const char *key) const
+{
+    int i = ExHeaders::find(key);
+
+    if (i >= 0) return m_hdr.get((ExHeaders::Id)i);
+    return fetchHeader(key);
+}
 
 void ExRequest::setCookie(const char* cookie)
 {
-    httpd_resp_set_hdr(m_req, http_set_cookie, cookie);
+    setHeader(http_set_cookie, cookie);
 }
 
-void ExRequest::parseCookie() 
+esp_err_t ExRequest::setHeader(const char *key, const char *val)
+{
+    /* respond() writes head itself, httpd copy is used by sendAll()/sendChunk() */
+    m_resp_hdr.add(key, val);
+    return httpd_resp_set_hdr(m_req, key, val);
+}
+
+/*!
+ * \brief Connection state (created on first use, freed by httpd when socket is closed).
+ *   Session context set by someone else (other handler / httpd user) is left alone - NULL is returned.
+ */
+ExSockCtx *ExRequest::sockCtx()
 {
-    const char *key = NULL, *value = NULL;
-    cgi_load_t load;
-    char* qr;
-    size_t i, len;
-    
-    if (m_cookie_mem) {
-        m_cookie.clear();
-        free(m_cookie_mem);
-        m_cookie_mem=NULL;
-    }
-    len = httpd_req_get_hdr_value_len(m_req, http_cookie);    
+    if (!m_req->sess_ctx) {
+        m_req->sess_ctx = new (std::nothrow) ExSockCtx();
+        m_req->free_ctx = ExSockCtx::release;
+    }
+    if (m_req->free_ctx != ExSockCtx::release) return NULL;
+    return (ExSockCtx *)m_req->sess_ctx;
+}
+
+/*!
+ * \brief Decode cookie string (raw values stay in src).
+ */
+static void express_cookie_decode(ExArena *a, const char *src, size_t len, ExRequestMap *m)
+{
+    char *d;
+
     if (len == 0) return;
-    /* Allocate memory for cookie string */
-    m_cookie_mem = (char *)malloc(len + 2);
-    if (!m_cookie_mem) return;
-    /* Get cookie string */
-    httpd_req_get_hdr_value_str(m_req, http_cookie, m_cookie_mem, len + 1);
-    // msg_error("Got cookie string: %s",m_cookie_mem);
-    /* decode cookie string */
-    load = cgi_load_key;
-    key = qr = m_cookie_mem;
-    value = NULL;
-    for (i = 0;i < len;++i) {
-        switch (qr[i]) {
-            case '=': {
-                load = cgi_load_value;
-                qr[i] = '\0';
-                value = &qr[i + 1];
-            } break;
-            case ';': {
-                if (load == cgi_load_key) {
-                    key = &qr[i + 1];
-                    value = NULL;
-                } else {
-                    qr[i] = '\0';
-                    load = cgi_load_key;
-                    if ((key) && (value)) {
-                        while (*key == ' ') key++;
-                        while (*value == ' ') value++;
-                        /* process key/value */
-                        // msg_error("Key: %s, value: %s", key, value);
-                        m_cookie.insert({ key, value });
-                    }
-                    key = &qr[i + 1];
-                    value = NULL;
-                }
-            } break;
-            default: break;
+    d = (char *)a->alloc(len + 1, 1);
+    if (d) express_parse_cookie(src, d, len, express_kv_insert, m);
+}
+
+void ExRequest::parseCookie() 
+{
+    const ExSpan &c = headers().cookie();
+    ExSockCtx *s = sockCtx();
+
+    m_cookie_parsed = true;
+    if (s) {
+        m_cookies = &s->cookies;
+        /* Same Cookie header as previous request on this connection - keep decoded table */
+        if ((s->cookie) && (s->cookie_len == c.len) && (memcmp(s->cookie, c.ptr, c.len) == 0)) return;
+        s->arena.reset();
+        s->cookies.clear();
+        s->cookie_len = c.len;
+        if ((s->cookie = s->arena.strndup(c.ptr, c.len)) != NULL) {
+            express_cookie_decode(&s->arena, s->cookie, c.len, &s->cookies);
+            return;
         }
     }
-    if ((key) && (value)) {
-        while (*key == ' ') key++;
-        while (*value == ' ') value++;
-        /* process key/value */
-        // msg_error("Key: %s, value: %s", key, value);
-        m_cookie.insert({ key, value });
-    }
+    /* No connection state - decode into request arena */
+    m_cookies = &m_cookie;
+    m_cookie.clear();
+    express_cookie_decode(m_arena, c.ptr, c.len, &m_cookie);
 }
 
 
-void ExRequest::parseParams()
+/*!
+ * \brief Get path parameter as NUL terminated string (copied on first access).
+ */
+const char *ExRequest::getParamString(const char *name)
 {
-    m_param.clear();
-    if (m_param_mem) free(m_param_mem);
-    if (m_key_mem) free(m_key_mem);
-    m_param_mem = strdup(this->uri());
-    m_key_mem = strdup(m_key);
-    {
-        bool final = false;
-        char *a = m_key_mem, *b = m_param_mem, *key, *val;
-        
-	    while ((*a != '\0') && (*b != '\0')) {
-    		if (*a == ':') {
-                a++;
-                key = a;
-                val = b;
-			    /* Skip section */
-			    while ((*a != '/') && (*a != '\0')) a++;
-			    while ((*b != '/') && (*b != '\0')) b++;
-                if ((*a== '\0') || (*b== '\0')) final = true;
-                *a='\0';
-                *b='\0';
-                msg_error("Key = %s, val = %s", key, val);
-                m_param.insert({ key, val });
-		    }
-            if (final) break;
-	    	a++;
-		    b++;
-	    }
+    ExRouteParam *p = m_params.find(name);
+    if (!p) return NULL;
+    /* Already copied (or last section of path) */
+    if (p->val[p->val_len] == '\0') return p->val;
+    if ((m_param_buf_len + p->val_len + 1) > EXPRESS_PARAM_BUF_SIZE) {
+        /* Long parameter (token, file name) - copy into request arena */
+        char *d = m_arena->strndup(p->val, p->val_len);
+        if (d) p->val = d;
+        return d;
     }
+    char *d = &m_param_buf[m_param_buf_len];
+    memcpy(d, p->val, p->val_len);
+    d[p->val_len] = '\0';
+    m_param_buf_len += p->val_len + 1;
+    p->val = d;
+    return d;
+}
+
+/*!
+ * \brief Get path parameter as integer (parsed directly from uri span).
+ */
+int ExRequest::getParamInt(const char *name, int defVal)
+{
+    int v;
+    const ExRouteParam *p = m_params.find(name);
+    if ((p) && (express_parse_int(p->val, p->val_len, &v))) return v;
+    return defVal;
 }
 
 
-esp_err_t ExRequest::json(njson v) 
-{ 
-    std::string s = v.dump();
-    return json(s.c_str(), s.length()); 
+esp_err_t ExRequest::json(const njson &v)
+{
+    ExResponseStream s(this, ExResponseProfile::json());
+    s << v;
+    return s.end();
 }
 
 
 esp_err_t ExRequest::json(const char* resp, int len)
 {
     if (len == 0) len = strlen(resp);
-    httpd_resp_set_status(m_req, http_200_hdr);
-    httpd_resp_set_type(m_req, http_content_type_json);
-    httpd_resp_set_hdr(m_req, http_cache_control_hdr, http_cache_control_no_cache);
-    httpd_resp_set_hdr(m_req, http_pragma_hdr, http_pragma_no_cache);
-    return httpd_resp_send(m_req, resp, len);
+    return respondDynamic(ExResponseProfile::json(), resp, len);
 }
 
 esp_err_t ExRequest::txt(const char* resp, int len)
 {
     if (len == 0) len = strlen(resp);
-    httpd_resp_set_status(m_req, http_200_hdr);
-    httpd_resp_set_type(m_req, http_content_type_txt);
-    httpd_resp_set_hdr(m_req, http_cache_control_hdr, http_cache_control_no_cache);
-    httpd_resp_set_hdr(m_req, http_pragma_hdr, http_pragma_no_cache);
-    return httpd_resp_send(m_req, resp, len);
+    return respondDynamic(ExResponseProfile::txt(), resp, len);
+}
+
+/*!
+ * \brief Send generated body (compressed when large and client accepts gzip).
+ */
+esp_err_t ExRequest::respondDynamic(const ExResponseProfile &p, const char *body, size_t len)
+{
+#ifdef CONFIG_EXPRESS_USE_GZIP
+    if ((len >= CONFIG_EXPRESS_GZIP_MIN) && (acceptsEncoding("gzip"))) {
+        ExResponseStream s(this, p);
+        s.write(body, len);
+        return s.end();
+    }
+    /* Sent as is - body still depends on Accept-Encoding (caches keep variants apart) */
+    m_failed = p.failed();
+    txWrite(p.head(), p.size());
+    txWrite(http_hdr_vary);
+    return txEnd(body, len);
+#else
+    return respond(p, body, len);
+#endif
 }
 
 esp_err_t ExRequest::send_res(esp_err_t ret)
@@ -1107,43 +1532,576 @@ esp_err_t ExRequest::send_res(esp_err_t ret)
     }
 }
 
+//===========================================================================
+//=========================--- Request body  ---=============================
+//===========================================================================
+
+size_t ExBody::length() const
+{
+    return m_rq->m_req->content_len;
+}
+
+/*!
+ * \brief Detect chunked body (httpd reports content_len = 0 for it).
+ *   Not supported: esp_http_server parser consumes the first chunk size line and hands the
+ *   rest of the buffer to the handler, so chunk boundaries can not be recovered.
+ */
+void ExBody::init()
+{
+    if (m_init) return;
+    m_init = true;
+    if (m_rq->m_req->content_len) return;
+    m_chunked = m_rq->getHeaderView("Transfer-Encoding").contains("chunked");
+}
+
+bool ExBody::leftover()
+{
+    /* GET/HEAD never carry a body - skip header lookup */
+    if ((!m_init) && ((m_rq->m_req->content_len) || (m_rq->m_req->method == HTTP_GET) || (m_rq->m_req->method == HTTP_HEAD))) return false;
+    return chunked();
+}
+
+/*!
+ * \brief Check limit (send 413 or 411 for chunked body once).
+ */
+bool ExBody::check()
+{
+    if (m_error) return false;
+    init();
+    if (m_chunked) {
+        msg_error("Chunked request body not supported");
+        m_error = true;
+        if (m_rq->m_sent == 0) m_rq->error(http_411_hdr);
+        return false;
+    }
+    if (tooLarge()) {
+        msg_error("Body too large (%u > %u)", (unsigned)length(), (unsigned)m_max);
+        m_error = true;
+        if (m_rq->m_sent == 0) m_rq->error(http_413_hdr);
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * \brief Chunk buffer for forEachChunk (request arena).
+ */
+char *ExBody::chunkBuf()
+{
+    if (!check()) return NULL;
+    return (char *)m_rq->m_arena->alloc(EXPRESS_BODY_CHUNK, 1);
+}
+
+/*!
+ * \brief Receive (retries timeouts).
+ */
+int ExBody::recv(char *buf, size_t len)
+{
+    int retry = 0;
+
+    while (1) {
+        int r = httpd_req_recv(m_rq->m_req, buf, len);
+        if (r > 0) return r;
+        /* Timeout - socket is still alive, try again */
+        if ((r == HTTPD_SOCK_ERR_TIMEOUT) && (++retry < EXPRESS_RECV_RETRIES)) continue;
+        msg_error("Body receive error %d (%u/%u B)", r, (unsigned)m_done, (unsigned)length());
+        m_error = true;
+        return -1;
+    }
+}
+
+int ExBody::read(char *buf, size_t len)
+{
+    int r;
+
+    if (!check()) return -1;
+    if (len > remaining()) len = remaining();
+    if (len == 0) return 0;
+    if ((r = recv(buf, len)) > 0) m_done += r;
+    return r;
+}
+
+/*!
+ * \brief Stream multipart/form-data body through parser.
+ */
+bool ExRequest::multipart(ExMultipartSelect select, void *ctx)
+{
+    ExSpan b;
+    char *buf;
+
+    if (!express_multipart_boundary(headers().contentType(), &b)) return false;
+    if (!m_body.check()) return false;
+    buf = (char *)m_arena->alloc(EXPRESS_MULTIPART_BUF, 1);
+    ExMultipart mp(b, buf, EXPRESS_MULTIPART_BUF, select, ctx);
+    while ((!mp.done()) && (!mp.failed())) {
+        size_t n;
+        char *p = mp.space(&n);
+        int r = m_body.read(p, n);
+        if (r <= 0) break;
+        mp.commit(r);
+    }
+    if (mp.done()) return true;
+    /* Body ended or receive failed before close delimiter */
+    mp.abort();
+    return false;
+}
+
+/*!
+ * \brief Read whole body (partial receives are joined, limit checked before allocation).
+ */
+std::string ExRequest::readAll()
+{
+    std::string res;
+    size_t n = 0;
+    int r;
+
+    if (!m_body.check()) return res;
+    /* Known length - one allocation */
+    res.resize(m_body.remaining());
+    while (n < res.size()) {
+        if ((r = m_body.read(&res[n], res.size() - n)) <= 0) return std::string();
+        n += r;
+    }
+    return res;
+}
+
 esp_err_t ExRequest::error(const char *status)
 {
-    httpd_resp_set_status(m_req, status);
-    httpd_resp_set_type(m_req, http_content_type_txt);
-    return httpd_resp_send(m_req, NULL, 0);
+    return respond(status, http_content_type_txt, NULL, NULL, 0);
 }
 
 
 esp_err_t ExRequest::gzip(const char* type, const char* resp, int len)
 {
     if (len == 0) len = strlen(resp);
-    httpd_resp_set_status(m_req, http_200_hdr);
-    httpd_resp_set_type(m_req, type);
-    httpd_resp_set_hdr(m_req, http_cache_control_hdr, http_cache_control_cache);
-    httpd_resp_set_hdr(m_req, "Content-Encoding", "gzip");
-    return httpd_resp_send(m_req, (const char*)resp, len);
+    return respond(http_200_hdr, type, http_hdr_cache_gzip, resp, len);
 }
 
 esp_err_t ExRequest::send(const char* type, const char* resp, int len)
 {
     if (len == 0) len = strlen(resp);
-    httpd_resp_set_status(m_req, http_200_hdr);
-    httpd_resp_set_type(m_req, type);
-    httpd_resp_set_hdr(m_req, http_cache_control_hdr, http_cache_control_cache);
-    return httpd_resp_send(m_req, (const char*)resp, len);
+    return respond(http_200_hdr, type, http_hdr_cache, resp, len);
 }
 
 
 esp_err_t ExRequest::redirect(const char *path, const char *type)
 {
-    httpd_resp_set_type(m_req, http_content_type_html);
-    httpd_resp_set_status(m_req, type);
-    httpd_resp_set_hdr(m_req, "Location", path);
-    httpd_resp_send(m_req, NULL, 0);
+    setHeader("Location", path);
+    respond(type, http_content_type_html, NULL, NULL, 0);
     return ESP_OK;
 }
 
+/*!
+ * \brief Send variant of static file accepted by client (highest q, smaller one on tie).
+ */
+esp_err_t ExRequest::sendStatic(const ExStaticFile &f)
+{
+    static const char *const coding[3] = { "br", "gzip", "identity" };
+    const ExStaticVariant *var[3] = { &f.br, &f.gzip, &f.identity };
+    const ExSpan &ae = headers().acceptEncoding();
+    const ExStaticVariant *v = NULL;
+    int q = 0;
+
+    for (int i = 0; i < 3; ++i) {
+        int vq;
+        if (!var[i]->head) continue;
+        vq = express_encoding_q(ae, coding[i]);
+        if (vq > q) {
+            q = vq;
+            v = var[i];
+        }
+    }
+    /* Nothing acceptable - send what we have (identity, then gzip like before negotiation) */
+    for (int i = 2; (i >= 0) && (!v); --i) {
+        if (var[i]->head) v = var[i];
+    }
+    return respond(*v->head, v->data, v->size);
+}
+
+//===========================================================================
+//=========================--- Response head  ---============================
+//===========================================================================
+
+ExResponseProfile::ExResponseProfile(const char *status, const char *type, const char *headers)
+{
+    m_head.reserve(32 + strlen(status) + strlen(type) + (headers ? strlen(headers) : 0));
+    m_head.append("HTTP/1.1 ").append(status).append("\r\nContent-Type: ").append(type).append("\r\n");
+    if (headers) m_head.append(headers);
+    m_failed = (*status >= '4');
+}
+
+const ExResponseProfile &ExResponseProfile::json()
+{
+    static const ExResponseProfile p(http_200_hdr, http_content_type_json, http_hdr_no_cache);
+    return p;
+}
+
+const ExResponseProfile &ExResponseProfile::txt()
+{
+    static const ExResponseProfile p(http_200_hdr, http_content_type_txt, http_hdr_no_cache);
+    return p;
+}
+
+esp_err_t ExRequest::respond(const ExResponseProfile &p, const char *body, size_t len)
+{
+    m_failed = p.failed();
+    txWrite(p.head(), p.size());
+    return txEnd(body, len);
+}
+
+esp_err_t ExRequest::respond(const char *status, const char *type, const char *headers, const char *body, size_t len)
+{
+    m_failed = (*status >= '4');
+    txWrite("HTTP/1.1 ", 9);
+    txWrite(status);
+    txWrite("\r\nContent-Type: ", 16);
+    txWrite(type);
+    txWrite("\r\n", 2);
+    if (headers) txWrite(headers);
+    return txEnd(body, len);
+}
+
+/*!
+ * \brief Add per request headers, Content-Length and body, flush buffer.
+ */
+esp_err_t ExRequest::txEnd(const char *body, size_t len)
+{
+    char cl[40];
+
+    for (const ExKV *h = m_resp_hdr.begin(); h != m_resp_hdr.end(); ++h) {
+        txWrite(h->key, h->key_len);
+        txWrite(": ", 2);
+        txWrite(h->raw, h->raw_len);
+        txWrite("\r\n", 2);
+    }
+    txWrite(cl, snprintf(cl, sizeof(cl), "Content-Length: %u\r\n\r\n", (unsigned)len));
+    if ((body) && (len)) txWrite(body, len);
+    if (m_tx_len) txSend(m_tx, m_tx_len);
+    m_tx_len = 0;
+    return sent(m_tx_err ? ESP_FAIL : ESP_OK, body, len);
+}
+
+/*!
+ * \brief Append to response buffer (full buffer is sent, big blocks go straight to socket).
+ */
+void ExRequest::txWrite(const char *d, size_t len)
+{
+    if (!m_tx) m_tx = m_e->txBuf();
+    if (!m_tx) {
+        /* No memory for buffer - send every part */
+        txSend(d, len);
+        return;
+    }
+    while ((len) && (!m_tx_err)) {
+        size_t n = EXPRESS_TX_BUF_SIZE - m_tx_len;
+        if ((m_tx_len == 0) && (len >= EXPRESS_TX_BUF_SIZE)) {
+            txSend(d, len);
+            return;
+        }
+        if (n > len) n = len;
+        memcpy(m_tx + m_tx_len, d, n);
+        m_tx_len += n;
+        d += n;
+        len -= n;
+        if (m_tx_len == EXPRESS_TX_BUF_SIZE) {
+            txSend(m_tx, m_tx_len);
+            m_tx_len = 0;
+        }
+    }
+}
+
+/*!
+ * \brief Send data to socket (retries timeouts like httpd does).
+ */
+void ExRequest::txSend(const char *d, size_t len)
+{
+    int retry = EXPRESS_RECV_RETRIES;
+
+    while ((len) && (!m_tx_err)) {
+        int r = httpd_send(m_req, d, len);
+        if (r == HTTPD_SOCK_ERR_TIMEOUT) {
+            if (--retry <= 0) m_tx_err = true;
+            continue;
+        }
+        if (r <= 0) {
+            msg_error("Response send failed (%d)", r);
+            m_tx_err = true;
+            break;
+        }
+        d += r;
+        len -= r;
+    }
+}
+
+/*!
+ * \brief Response head in request arena (profile, setHeader() headers and framing line).
+ */
+const char *ExRequest::head(const ExResponseProfile &p, const char *framing, size_t *len)
+{
+    size_t fl = strlen(framing), n = p.size() + fl;
+    char *h, *d;
+
+    for (const ExKV *i = m_resp_hdr.begin(); i != m_resp_hdr.end(); ++i) n += i->key_len + i->raw_len + 4;
+    h = d = (char *)m_arena->alloc(n, 1);
+    if (!h) return NULL;
+    memcpy(d, p.head(), p.size());
+    d += p.size();
+    for (const ExKV *i = m_resp_hdr.begin(); i != m_resp_hdr.end(); ++i) {
+        memcpy(d, i->key, i->key_len);
+        d += i->key_len;
+        *d++ = ':';
+        *d++ = ' ';
+        memcpy(d, i->raw, i->raw_len);
+        d += i->raw_len;
+        *d++ = '\r';
+        *d++ = '\n';
+    }
+    memcpy(d, framing, fl);
+    *len = n;
+    return h;
+}
+
+//===========================================================================
+//=========================--- Response stream  ---==========================
+//===========================================================================
+
+/* Buffer layout: chunk size line, data, CRLF and last chunk (0\r\n\r\n) */
+#define EXSTREAM_HDR (6)
+#define EXSTREAM_CAP (EXPRESS_TX_BUF_SIZE - EXSTREAM_HDR - 2 - 5)
+static_assert(EXPRESS_TX_BUF_SIZE <= 0xffff, "EXPRESS_TX_BUF_SIZE: chunk size must fit in 4 hex digits");
+/* startGzip() moves whole buffer into compressor window before any output */
+static_assert(2 * EXPRESS_GZIP_WINDOW >= EXPRESS_TX_BUF_SIZE, "EXPRESS_GZIP_WINDOW too small for EXPRESS_TX_BUF_SIZE");
+
+ExResponseStream::ExResponseStream(ExRequest *rq, const ExResponseProfile &p)
+{
+    m_rq = rq;
+    m_p = &p;
+    m_buf = rq->m_e->txBuf();
+    m_len = 0;
+    m_total = 0;
+    m_chunked = false;
+    m_done = false;
+#ifdef CONFIG_EXPRESS_USE_GZIP
+    m_compress = true;
+#else
+    m_compress = false;
+#endif
+    m_vary = m_compress;
+    m_z = NULL;
+    rq->m_failed = p.failed();
+}
+
+ExResponseStream &ExResponseStream::write(const char *d, size_t len)
+{
+    if ((m_done) || (failed())) return *this;
+    m_total += len;
+    while (len) {
+        size_t n;
+        if (m_z) {
+            m_z->write(d, len);
+            break;
+        }
+        /* Send only when more data comes - full buffer at end() is still one plain response */
+        if (m_len == EXSTREAM_CAP) {
+            flush(false);
+            if (failed()) break;
+            continue;
+        }
+        n = EXSTREAM_CAP - m_len;
+        if (n > len) n = len;
+        memcpy(m_buf + EXSTREAM_HDR + m_len, d, n);
+        m_len += n;
+        d += n;
+        len -= n;
+    }
+    return *this;
+}
+
+/*!
+ * \brief Append data to be sent as is (compressor output, head already sent).
+ */
+void ExResponseStream::put(const char *d, size_t len)
+{
+    while ((len) && (!failed())) {
+        size_t n;
+        if (m_len == EXSTREAM_CAP) flush(false);
+        n = EXSTREAM_CAP - m_len;
+        if (n > len) n = len;
+        memcpy(m_buf + EXSTREAM_HDR + m_len, d, n);
+        m_len += n;
+        d += n;
+        len -= n;
+    }
+}
+
+/*!
+ * \brief Start gzip stage (body above CONFIG_EXPRESS_GZIP_MIN and client accepts it).
+ */
+bool ExResponseStream::startGzip()
+{
+    const char *h;
+    size_t hl, n;
+
+    if ((!m_compress) || (m_total < CONFIG_EXPRESS_GZIP_MIN) || (!m_rq->acceptsEncoding("gzip"))) return false;
+    m_z = new (std::nothrow) ExDeflate(gzOut, this);
+    if ((!m_z) || (!m_z->ok())) {
+        /* No memory - send as is */
+        delete m_z;
+        m_z = NULL;
+        m_compress = false;
+        return false;
+    }
+    h = m_rq->head(*m_p, "Content-Encoding: gzip\r\nVary: Accept-Encoding\r\nTransfer-Encoding: chunked\r\n\r\n", &hl);
+    if (!h) {
+        m_rq->m_tx_err = true;
+        return true;
+    }
+    m_rq->txSend(h, hl);
+    m_chunked = true;
+    /* Buffered body goes through compressor, output refills the buffer */
+    n = m_len;
+    m_len = 0;
+    m_z->write(m_buf + EXSTREAM_HDR, n);
+    return true;
+}
+
+int ExResponseStream::printf(const char *fmt, ...)
+{
+    va_list ap, aq;
+    size_t room;
+    int n;
+
+    if ((m_done) || (failed())) return -1;
+    /* Compressed: format aside (buffer holds compressor output) */
+    room = m_z ? 0 : EXSTREAM_CAP - m_len;
+    va_start(ap, fmt);
+    va_copy(aq, ap);
+    /* NUL lands in CRLF reserve */
+    n = m_z ? vsnprintf(NULL, 0, fmt, ap) : vsnprintf(m_buf + EXSTREAM_HDR + m_len, room + 1, fmt, ap);
+    if ((n >= 0) && ((size_t)n <= room)) {
+        m_len += n;
+        m_total += n;
+    } else if (n > 0) {
+        /* No room - format aside and split between buffers */
+        char tmp[128];
+        char *t = ((size_t)n < sizeof(tmp)) ? tmp : (char *)m_rq->m_arena->alloc(n + 1, 1);
+        if (t) {
+            vsnprintf(t, n + 1, fmt, aq);
+            write(t, n);
+        } else {
+            n = -1;
+        }
+    }
+    va_end(aq);
+    va_end(ap);
+    return n;
+}
+
+/* JSON serializer output adapter */
+class ExStreamJSONSink : public ExJSON::ExJSONSink {
+public:
+    ExStreamJSONSink(ExResponseStream &s) : m_s(s) {}
+    void write(const char *s, size_t len) override { m_s.write(s, len); }
+private:
+    ExResponseStream &m_s;
+};
+
+ExResponseStream &ExResponseStream::operator << (const njson &v)
+{
+    ExStreamJSONSink sink(*this);
+    v.dump(sink);
+    return *this;
+}
+
+ExResponseStream &ExResponseStream::writeUInt(unsigned long long v)
+{
+    char b[24], *p = b + sizeof(b);
+
+    do { *--p = '0' + (v % 10); v /= 10; } while (v);
+    return write(p, b + sizeof(b) - p);
+}
+
+ExResponseStream &ExResponseStream::writeInt(long long v)
+{
+    if (v >= 0) return writeUInt(v);
+    write("-", 1);
+    return writeUInt(0ULL - (unsigned long long)v);
+}
+
+/*!
+ * \brief Send buffer (first call sends head: Content-Length when last, chunked otherwise).
+ */
+void ExResponseStream::flush(bool last)
+{
+    char *s = m_buf + EXSTREAM_HDR, *e = s + m_len;
+    const char *h;
+    size_t hl;
+
+    if (!m_chunked) {
+        char cl[64];
+#ifdef CONFIG_EXPRESS_USE_GZIP
+        if ((!last) && (startGzip())) return;
+#endif
+        /* Not compressed (small body, no gzip in Accept-Encoding, no memory) - still a variant */
+        if (last) snprintf(cl, sizeof(cl), "%sContent-Length: %u\r\n\r\n", m_vary ? http_hdr_vary : "", (unsigned)m_len);
+        else snprintf(cl, sizeof(cl), "%sTransfer-Encoding: chunked\r\n\r\n", m_vary ? http_hdr_vary : "");
+        h = m_rq->head(*m_p, cl, &hl);
+        if (!h) {
+            m_rq->m_tx_err = true;
+            return;
+        }
+        if (last) {
+            /* Whole body in buffer - head in front of data, one write */
+            if (hl + m_len <= EXPRESS_TX_BUF_SIZE) {
+                memmove(m_buf + hl, s, m_len);
+                memcpy(m_buf, h, hl);
+                m_rq->txSend(m_buf, hl + m_len);
+            } else {
+                m_rq->txSend(h, hl);
+                m_rq->txSend(s, m_len);
+            }
+            m_len = 0;
+            return;
+        }
+        m_rq->txSend(h, hl);
+        m_chunked = true;
+    }
+    if (m_len) {
+        snprintf(m_buf, 5, "%04x", (unsigned)m_len);
+        m_buf[4] = '\r';
+        m_buf[5] = '\n';
+        s = m_buf;
+        *e++ = '\r';
+        *e++ = '\n';
+    }
+    if (last) {
+        memcpy(e, "0\r\n\r\n", 5);
+        e += 5;
+    }
+    if (e != s) m_rq->txSend(s, e - s);
+    m_len = 0;
+}
+
+esp_err_t ExResponseStream::end()
+{
+    size_t sent = m_total;
+
+    if (m_done) return failed() ? ESP_FAIL : ESP_OK;
+    m_done = true;
+    if (!m_buf) return m_rq->error("500 Internal Server Error");
+#ifdef CONFIG_EXPRESS_USE_GZIP
+    if (!m_chunked) startGzip();
+#endif
+    if (m_z) {
+        m_z->finish();
+        sent = m_z->out();
+        delete m_z;
+        m_z = NULL;
+    }
+    flush(true);
+    return m_rq->sent(m_rq->m_tx_err ? ESP_FAIL : ESP_OK, m_buf, sent);
+}
+
 /*!
  * \brief Send command return code and value over websocket.
  */
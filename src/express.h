@@ -23,15 +23,36 @@
 #include <list>
 #include <vector>
 #include <exjson.hpp>
+#include <exfunction.hpp>
+#include <exarena.hpp>
+#include <exkv.hpp>
+#include <exctx.hpp>
+#include "exroute.h"
+#include "exparse.h"
+#include "exmultipart.h"
+#include "exdeflate.h"
+#if __cplusplus >= 201703L
+#include <optional>
+#define EXPRESS_TYPED_ARGS 1
+#endif
 
 using njson = ExJSON::ExJSONVal;
 
+#ifndef EXPRESS_PARAM_BUF_SIZE
+#define EXPRESS_PARAM_BUF_SIZE (128)
+#endif
+
 struct www_file_t {
     const char *name;
     int size;
     const char *data;
-    int gz;
+    int gz;                     /*!< data is gzip compressed.                    */
     const char* mime_type;
+    /* Optional variants (generate_www), chosen by Accept-Encoding - 0 when missing */
+    int br_size;
+    const char *br;             /*!< Brotli compressed data.                     */
+    int identity_size;
+    const char *identity;       /*!< Uncompressed data (when data is gzip).      */
 };
 
 /*!
@@ -45,6 +66,15 @@ public:
     }
 };
 
+/* Request tables (allocated from request arena) */
+typedef ExKVTable<> ExRequestMap;
+typedef std::map<std::string, std::string, std::less<std::string>,
+    ExArenaAllocator<std::pair<const std::string, std::string> > > ExRequestUserMap;
+
+/* Built-in context keys (see ExRequest::ctx) */
+struct ExSessionId { typedef const char *type; };               /*!< Session ID (arena string). */
+struct ExSessionCookie { typedef const char *type; };           /*!< Set-Cookie value for new session. */
+
 class Express;
 class ExRequest;
 class WSRequest;
@@ -63,18 +93,18 @@ time_t express_get_time_s();
 uint64_t express_get_time_ms(); 
 
 /*!
- * \brief Page callback.
+ * \brief Page callback (stored inline, see EXPRESS_CB_INLINE_SIZE).
  * \param c - pointer to Express class,
  * \param req - pointer to request/response class.
  */
-typedef std::function<void(ExRequest* req)> ExpressPageCB;
+typedef ExFunction<void(ExRequest* req)> ExpressPageCB;
 /*!
- * \brief Middleware callback.
+ * \brief Middleware callback (stored inline, see EXPRESS_CB_INLINE_SIZE).
  * \param c - pointer to Express class,
  * \param req - pointer to request/response class.
  * \return true - process next middleware or page, false - break processing.
  */
-typedef std::function<bool(ExRequest* req)> ExpressMidCB;
+typedef ExFunction<bool(ExRequest* req)> ExpressMidCB;
 typedef const std::vector<ExpressMidCB> ExpressMidCBList;
 
 /*!
@@ -92,104 +122,363 @@ typedef std::function<void(WSRequest* req)> ExpressWSCB;
  */
 typedef std::function<void(WSRequest* req, char* arg, int arg_len)> ExpressWSON;
 
-typedef std::map<const char*, ExpressPageCB, ExRequest_cmp_str> ExpressPgMap;
-typedef std::list<std::pair<const char*, ExpressPageCB> > ExpressPgList;
 typedef std::list<std::pair<const char*, ExpressMidCB> > ExpressMidMap;
 
+/*!
+ * \brief HTTP method bits used in route table.
+ */
+#define EXPRESS_METHOD(m) ((((unsigned)(m)) < 32) ? (1UL << (m)) : 0)
+#define EXPRESS_GET       EXPRESS_METHOD(HTTP_GET)
+#define EXPRESS_POST      EXPRESS_METHOD(HTTP_POST)
+#define EXPRESS_DELETE    EXPRESS_METHOD(HTTP_DELETE)
+#define EXPRESS_PATCH     EXPRESS_METHOD(HTTP_PATCH)
+#define EXPRESS_PUT       EXPRESS_METHOD(HTTP_PUT)
+#define EXPRESS_ALL       (EXPRESS_GET | EXPRESS_POST | EXPRESS_DELETE | EXPRESS_PATCH | EXPRESS_PUT)
+
+/*!
+ * \brief Middleware reference in precomputed chain.
+ */
+struct ExpressMidRef {
+    const char         *path;   /*!< Middleware path (request key).                */
+    const ExpressMidCB *cb;     /*!< Middleware callback.                          */
+    bool                check;  /*!< Compare path at runtime.                      */
+    bool                scope;  /*!< Router-wide (path = router prefix, checked on miss). */
+};
+
+/*!
+ * \brief Slice of precomputed middleware chain.
+ */
+struct ExpressChain {
+    uint16_t first, count;
+};
+
+/*!
+ * \brief Registered pages (route trie + callbacks and middleware chains indexed by route id).
+ */
+struct ExpressPgTable {
+    ExRouteTable               routes;
+    std::vector<ExpressPageCB> cb;
+    std::vector<ExpressChain>  chain;   /*!< Precomputed chain (slice of Express::m_chain). */
+    std::vector<ExpressChain>  local;   /*!< Page middlewares (slice of mid).               */
+    std::vector<ExpressMidCB>  mid;     /*!< Page middlewares of all pages (flat).          */
+    std::vector<uint16_t>      scope;   /*!< Middleware scope (mounted router).             */
+    std::vector<uint32_t>      limit;   /*!< Max body size (0 = default, see bodyLimit()).  */
+    void add(const char* path, uint32_t methods, const ExpressMidCB *m, size_t n, ExpressPageCB c, uint16_t s = 0, uint32_t l = 0) {
+        routes.add(path, methods);
+        cb.push_back(c);
+        local.push_back({ (uint16_t)mid.size(), (uint16_t)n });
+        mid.insert(mid.end(), m, m + n);
+        scope.push_back(s);
+        limit.push_back(l);
+    }
+};
+
+/*!
+ * \brief Middlewares of one router (Express itself or mounted ExRouter).
+ */
+struct ExpressScope {
+    int                        parent;  /*!< Parent scope (-1 = none).                       */
+    std::vector<ExpressMidRef> mid;     /*!< Middlewares with full path (check = path scoped, scope = router-wide). */
+};
+
+#ifdef CONFIG_EXPRESS_USE_METRICS
+/* Number of latency buckets (bucket i counts requests served in <= 256us << i, last one the rest) */
+#ifndef EXPRESS_METRICS_BUCKETS
+#define EXPRESS_METRICS_BUCKETS (12)
+#endif
+
+/*!
+ * \brief Route counters (one table per core, written only by the httpd task on that core).
+ */
+struct ExpressRouteStats {
+    uint32_t hits;                              /*!< Served requests.                          */
+    uint32_t errors;                            /*!< 4xx/5xx responses and send failures.      */
+    uint64_t bytes;                             /*!< Response body bytes.                      */
+    uint64_t time_us;                           /*!< Total time spent in middlewares and page. */
+    uint32_t hist[EXPRESS_METRICS_BUCKETS];     /*!< Latency histogram.                        */
+};
+#endif
+
+
+
+#ifndef CONFIG_EXPRESS_GZIP_MIN
+#define CONFIG_EXPRESS_GZIP_MIN (1024)
+#endif
+/* Default max request body size (bytes, 0 = no limit) */
+#ifndef CONFIG_EXPRESS_MAX_BODY
+#define CONFIG_EXPRESS_MAX_BODY (0)
+#endif
+/* Body reader chunk size (arena buffer used by forEachChunk) */
+#ifndef EXPRESS_BODY_CHUNK
+#define EXPRESS_BODY_CHUNK (512)
+#endif
+/* Receive timeouts tolerated in a row before body read fails */
+#ifndef EXPRESS_RECV_RETRIES
+#define EXPRESS_RECV_RETRIES (5)
+#endif
+
+/*!
+ * \brief Request body reader (bounded memory, body is not buffered).
+ *   Transfer-Encoding: chunked bodies are answered with 411 Length Required (see init()).
+ */
+class ExBody {
+public:
+    ExBody(ExRequest *rq) : m_rq(rq), m_max(CONFIG_EXPRESS_MAX_BODY), m_done(0), m_error(false), m_init(false), m_chunked(false) {}
 
+    /*!
+     * \brief Set max body size, 0 = no limit (413 Payload Too Large is sent on first read above it).
+     */
+    void setLimit(size_t max) { m_max = max; }
+    size_t limit() const { return m_max; }
+    /* Content-Length (0 for chunked body) */
+    size_t length() const;
+    size_t remaining() const { return length() - m_done; }
+    size_t received() const { return m_done; }
+    bool tooLarge() const { return (m_max) && (length() > m_max); }
+    bool failed() const { return m_error; }
+    bool chunked() { init(); return m_chunked; }
+    /* Chunked body left in socket (connection can not be reused) */
+    bool leftover();
+
+    /*!
+     * \brief Read next part of body (retries receive timeouts).
+     * \return bytes read (may be less than len), 0 at the end of body, -1 on error.
+     */
+    int read(char *buf, size_t len);
+    /* Check limit (sends 413 once), false when body must not be read */
+    bool check();
+
+    /*!
+     * \brief Call cb(const char *data, size_t len) for every received chunk (cb returns false to stop).
+     * \return true when the whole body was consumed.
+     */
+    template <typename F>
+    bool forEachChunk(F cb) {
+        char *buf = chunkBuf();
+        int r;
+        if (!buf) return false;
+        while ((r = read(buf, EXPRESS_BODY_CHUNK)) > 0) {
+            if (!cb((const char *)buf, (size_t)r)) return false;
+        }
+        return r == 0;
+    }
+
+private:
+    void init();
+    char *chunkBuf();
+    int recv(char *buf, size_t len);
+
+    ExRequest *m_rq;
+    size_t     m_max, m_done;
+    bool       m_error, m_init, m_chunked;
+};
+
+/*!
+ * \brief Common request headers (each one fetched on first access, values are NUL terminated).
+ */
+class ExHeaders {
+public:
+    enum Id { ContentType, Cookie, AcceptEncoding, IfNoneMatch, Authorization, Count };
+    ExHeaders(const ExRequest *rq) : m_rq(rq), m_ready(0) {}
+    const ExSpan &get(Id id) const;
+    const ExSpan &contentType() const    { return get(ContentType); }
+    const ExSpan &cookie() const         { return get(Cookie); }
+    const ExSpan &acceptEncoding() const { return get(AcceptEncoding); }
+    const ExSpan &ifNoneMatch() const    { return get(IfNoneMatch); }
+    const ExSpan &authorization() const  { return get(Authorization); }
+    /* Header id by name (-1 when not a common header) */
+    static int find(const char *key);
+
+private:
+    const ExRequest *m_rq;
+    mutable uint8_t m_ready;                                          /*!< Fetched headers (bit per Id). */
+    mutable ExSpan  m_v[Count];
+};
+
+/* Per connection memory block (Cookie header copy and decoded cookies) */
+#ifndef EXPRESS_SOCK_ARENA_SIZE
+#define EXPRESS_SOCK_ARENA_SIZE (512)
+#endif
+
+/*!
+ * \brief Per connection state (httpd session context, recognised by free_ctx == ExSockCtx::release).
+ *   Kept across keep-alive requests, decoded cookies are reused while Cookie header is the same.
+ */
+struct ExSockCtx {
+    ExSockCtx() : arena(EXPRESS_SOCK_ARENA_SIZE), cookies(&arena), cookie(NULL), cookie_len(0) {}
+    static void release(void *p) { delete (ExSockCtx *)p; }
+
+    ExArena       arena;                /*!< Reset when Cookie header changes.         */
+    ExRequestMap  cookies;              /*!< Decoded cookies (strings in arena).       */
+    char         *cookie;               /*!< Cookie header of last parse (NULL = none). */
+    size_t        cookie_len;
+};
+
+/* Response write buffer (one TCP segment, shared - see Express::txBuf()) */
+#ifndef EXPRESS_TX_BUF_SIZE
+#define EXPRESS_TX_BUF_SIZE (1436)
+#endif
+
+/*!
+ * \brief Prebuilt response head (status line, Content-Type and fixed headers).
+ *   Built once (static or at route registration), sent together with per request
+ *   headers, Content-Length and body in one buffered write (see ExRequest::respond()).
+ */
+class ExResponseProfile {
+public:
+    /* headers = "Key: value\r\n" lines (NULL = none) */
+    ExResponseProfile(const char *status, const char *type, const char *headers = NULL);
+    const char *head() const { return m_head.data(); }
+    size_t size() const { return m_head.size(); }
+    bool failed() const { return m_failed; }
+    /* Built-in profiles (200 OK, no-cache) used by json() and txt() */
+    static const ExResponseProfile &json();
+    static const ExResponseProfile &txt();
+private:
+    std::string m_head;
+    bool        m_failed;
+};
+
+/*!
+ * \brief Encoded variant of static file (prebuilt head, data).
+ */
+struct ExStaticVariant {
+    const ExResponseProfile *head;      /*!< NULL = variant missing. */
+    const char              *data;
+    int                      size;
+};
+
+/*!
+ * \brief Static file with more than one encoding (see Express::addStatic()).
+ */
+struct ExStaticFile {
+    ExStaticVariant br, gzip, identity;
+};
 
 /*!
  * \brief HTTP Request/Response.
  */
 class ExRequest {
 public:
-    ExRequest(httpd_req_t* rq, Express *e) {
-        m_url = strdup(rq->uri);
-        m_uri = m_url;
+    ExRequest(httpd_req_t* rq, Express *e, ExArena *a) :
+        m_hdr(this), m_query(a), m_cookie(a), m_body(this), m_ctx(a), m_user(std::less<std::string>(), a), m_json(nullJson()), m_resp_hdr(a) {
+        m_arena = a;
         m_req = rq;
         m_key = "";
         m_e = e;
-        m_cookie_mem = NULL;
-        m_param_mem = NULL;
-        m_key_mem = NULL;
+        m_cookie_parsed = false;
+        m_cookies = &m_cookie;
+        m_query_parsed = false;
+        m_params.route = -1;
+        m_params.count = 0;
+        m_param_buf_len = 0;
+        m_sent = 0;
+        m_failed = false;
+        m_tx = NULL;
+        m_tx_len = 0;
+        m_tx_err = false;
 #ifdef CONFIG_EXPRESS_USE_AUTH
         m_session = NULL;
 #endif
         parseURI();
     }
 
-    ~ExRequest() {
-        m_query.clear();
-        m_cookie.clear();
-        if (m_url) ::free((void *)m_url);
-        if (m_cookie_mem) ::free((void *)m_cookie_mem);
-        if (m_param_mem) ::free((void *)m_param_mem);
-        if (m_key_mem) ::free((void *)m_key_mem);
+    /* Strings and tables are released by arena reset */
+    ~ExRequest() {}
+    /* Typed context (slot created on first use) */
+    template <typename K> typename K::type &ctx() { return m_ctx.get<K>(); }
+    template <typename K> typename K::type *findCtx() const { return m_ctx.find<K>(); }
+    /* Request path without leading '/' and query string */
+    const char* uri() {
+        /* View into httpd buffer ends on '?' - copy path (first call only) */
+        if (m_uri[m_uri_len] != '\0') m_uri = m_arena->strndup(m_uri, m_uri_len);
+        return m_uri;
     }
-    const char* uri() const { return m_uri; }
+    size_t uriLen() const { return m_uri_len; }
     int getMethod() { return m_req->method; }
 
     void setKey(const char *key) { m_key = key; }
 
-    /* Parameters from query like /xxx?nr=0&val=3  (key = [nr, val])*/
+    /* Parameters from query like /xxx?nr=0&val=3  (key = [nr, val], parsed on first use)*/
     const char* getArg(const char* key) {
-        auto i = m_query.find(key);
-        if (i == m_query.end()) return NULL;
-        return i->second;
+        if (!m_query_parsed) parseQuery();
+        return m_query.find(key);
     }
     int getArgInt(const char* key, int df = -1) {
-        int v = df;
-        auto i = m_query.find(key);
-        if (i == m_query.end()) return df;
-        if (sscanf(i->second, "0x%x", &v) == 1) return v;
-        if (sscanf(i->second, "%d", &v) == 1) return v;
+        int v;
+        const char *s = getArg(key);
+        if ((s) && (express_parse_int(s, strlen(s), &v))) return v;
         return df;
     }
+#ifdef EXPRESS_TYPED_ARGS
+    /* Typed value: int, int64_t, unsigned, ExHex, float, double, bool (nullopt if missing or invalid) */
+    template <typename T> std::optional<typename ExParse<T>::type> getArg(const char* key) {
+        typename ExParse<T>::type v;
+        const char *s = getArg(key);
+        if ((s) && (ExParse<T>::parse(s, strlen(s), &v))) return v;
+        return std::nullopt;
+    }
+#endif
     
+    /* Undecoded value (no %XX / '+' processing) */
+    const char* getArgRaw(const char* key) {
+        if (!m_query_parsed) parseQuery();
+        return rawValue(m_query.entry(key));
+    }
+
     /* Parameters from cookie */
     const char* getCookie(const char* key) {
-        if (!m_cookie_mem) parseCookie();
-        auto i = m_cookie.find(key);
-        if (i == m_cookie.end()) return NULL;
-        return i->second;
+        if (!m_cookie_parsed) parseCookie();
+        return m_cookies->find(key);
     }
+    const char* getCookieRaw(const char* key) {
+        if (!m_cookie_parsed) parseCookie();
+        return rawValue(m_cookies->entry(key));
+    }
+    /* Connection state (created on first use, NULL when out of memory or sess_ctx is not ours) */
+    ExSockCtx *sockCtx();
     void setCookie(const char* cookie);
     
     /* Parameters from uri like /api/add/:id/:val (name = [id, val]) */
-    const char *getParamString(const char *name) {
-        if (!m_param_mem) parseParams();
-        auto i = m_param.find(name);
-        if (i == m_param.end()) return NULL;
-        return i->second;
-    }
-    int getParamInt(const char *name, int defVal = -1) {
-        int v = defVal;
-        const char *val = getParamString(name);
-        if (val) {
-            if (sscanf(val, "0x%x", &v) == 1) return v;
-            if (sscanf(val, "%d", &v) == 1) return v;
-        }
-        return defVal;
+    const char *getParamString(const char *name);
+    int getParamInt(const char *name, int defVal = -1);
+#ifdef EXPRESS_TYPED_ARGS
+    template <typename T> std::optional<typename ExParse<T>::type> getParam(const char *name) {
+        typename ExParse<T>::type v;
+        const ExRouteParam *p = m_params.find(name);
+        if ((p) && (ExParse<T>::parse(p->val, p->val_len, &v))) return v;
+        return std::nullopt;
     }
+#endif
 
     /* Read data (from post for example) */
     int getContentLen() const { return m_req->content_len; }
-    std::string getHeader(const char *key) const;
-    std::string getContentType() const;
-    std::string readAll() {
-        int len = m_req->content_len;
-        std::string res(len, 0);
-        if ( httpd_req_recv(m_req, (char *)&res[0], len) == len) {
-            return res;
-        }
-        return std::string();
-    }
-    int read(char *buf, int len) {
-        return httpd_req_recv(m_req, buf, len);
+    /* Headers (views into request arena, valid until the handler returns) */
+    const ExHeaders &headers() const { return m_hdr; }
+    ExSpan getHeaderView(const char *key) const;
+    /* Content coding allowed by Accept-Encoding (gzip, br, identity ...) */
+    bool acceptsEncoding(const char *coding) const { return express_encoding_q(headers().acceptEncoding(), coding) > 0; }
+    std::string getHeader(const char *key) const { ExSpan v = getHeaderView(key); return std::string(v.ptr, v.len); }
+    std::string getContentType() const { const ExSpan &v = headers().contentType(); return std::string(v.ptr, v.len); }
+    /* Body stream (limit checked before anything is allocated) */
+    ExBody &body() { return m_body; }
+    /* Whole body as string (empty on error or when above limit) */
+    std::string readAll();
+    int read(char *buf, int len) { return m_body.read(buf, len); }
+    /*!
+     * \brief Stream multipart/form-data body (EXPRESS_MULTIPART_BUF buffer, body limit applies).
+     *   select(const ExMultipartPart &) returns sink for part or NULL to skip it.
+     * \return true when all parts were received (on error only 413 for body above limit is sent).
+     */
+    bool multipart(ExMultipartSelect select, void *ctx);
+    template <typename F>
+    bool multipart(F select) {
+        return multipart([](void *c, const ExMultipartPart &p) -> ExMultipartSink * { return (*(F *)c)(p); }, &select);
     }
 
     /* Write answer */
-    esp_err_t json(njson v);
+    /* Serialized straight into response buffer (chunked when above EXPRESS_TX_BUF_SIZE) */
+    esp_err_t json(const njson &v);
     esp_err_t json(const char* resp, int len = 0);
     esp_err_t json(std::string& s) { return json(s.c_str(), s.length()); }
     esp_err_t txt(const char* resp, int len = 0);
@@ -198,16 +487,24 @@ public:
     esp_err_t send(const char* type, const char* resp, int len);
     esp_err_t send_res(esp_err_t ret);
     esp_err_t error(const char *);
+    /*!
+     * \brief Send whole response in one buffered write (headers from setHeader() are included).
+     */
+    esp_err_t respond(const ExResponseProfile &p, const char *body, size_t len);
+    esp_err_t respond(const char *status, const char *type, const char *headers, const char *body, size_t len);
+    /* Send variant of static file accepted by client (br, gzip, identity) */
+    esp_err_t sendStatic(const ExStaticFile &f);
     /* Low level versions */
-    esp_err_t setStatus(const char *status) { return httpd_resp_set_status(m_req, status); }
+    esp_err_t setStatus(const char *status) { m_failed = (*status >= '4'); return httpd_resp_set_status(m_req, status); }
     esp_err_t setType(const char *type) { return httpd_resp_set_type(m_req, type); }
-    esp_err_t setHeader(const char *key, const char *val) { return httpd_resp_set_hdr(m_req, key, val); }
-    esp_err_t sendAll(const char* buf, int buf_len) {return httpd_resp_send(m_req, buf, buf_len); }
+    /* Key and value must stay valid until the response is sent */
+    esp_err_t setHeader(const char *key, const char *val);
+    esp_err_t sendAll(const char* buf, int buf_len) { return sent(httpd_resp_send(m_req, buf, buf_len), buf, buf_len); }
     /*!
      * \brief Send in chunks. When you are finished sending all your chunks, you must call
      *   this function with buf_len as 0.
      */
-    esp_err_t sendChunk(const char* buf, int buf_len) { return httpd_resp_send_chunk(m_req, buf, buf_len); }
+    esp_err_t sendChunk(const char* buf, int buf_len) { return sent(httpd_resp_send_chunk(m_req, buf, buf_len), buf, buf_len); }
     
 
 
@@ -215,25 +512,125 @@ public:
     esp_err_t redirect(const char *path, const char *type = "302 Found");
 
 private:
+    static const njson &nullJson();
     void parseURI();
-    void parseParams();
+    void parseQuery();
     void parseCookie();
+    ExSpan fetchHeader(const char *key) const;
+    friend class ExHeaders;
+    const char *rawValue(const ExKV *kv);
+    friend class ExResponseStream;
+    /* Response head in request arena (profile, setHeader() headers and framing line) */
+    const char *head(const ExResponseProfile &p, const char *framing, size_t *len);
+    esp_err_t respondDynamic(const ExResponseProfile &p, const char *body, size_t len);
+    /* Raw response writer (Express::txBuf(), flushed with httpd_send) */
+    void txWrite(const char *d, size_t len);
+    void txWrite(const char *s) { txWrite(s, strlen(s)); }
+    void txSend(const char *d, size_t len);
+    esp_err_t txEnd(const char *body, size_t len);
+    /* Account sent data (metrics) */
+    esp_err_t sent(esp_err_t ret, const char *buf, int len) {
+        if (ret != ESP_OK) m_failed = true; else if (buf) m_sent += (len < 0) ? strlen(buf) : len;
+        return ret;
+    }
 
 public:
     Express      *m_e;
     httpd_req_t  *m_req;
-    char *m_url, *m_cookie_mem, *m_param_mem, *m_key_mem;
+    ExArena      *m_arena;                                            /*!< Request memory (reset before next request). */
+    bool m_cookie_parsed;
+    ExHeaders m_hdr;                                                  /*!< Common headers (see headers()). */
     const char *m_uri, *m_key;
-    std::map<const char*, const char*, ExRequest_cmp_str> m_query;    /*!< Parameters from query.   */
-    std::map<const char*, const char*, ExRequest_cmp_str> m_cookie;   /*!< Parameters from cookie.  */
-    std::map<const char*, const char*, ExRequest_cmp_str> m_param;    /*!< Parameters from path.    */
-    std::map<std::string, std::string> m_user;                        /*!< Additional parameters.   */
+    size_t m_uri_len;                                                 /*!< Path length (m_uri points into httpd buffer). */
+    const char *m_qs;                                                 /*!< Query string in httpd buffer (NULL = none). */
+    bool m_query_parsed;
+    ExRequestMap m_query;                                             /*!< Parameters from query (filled by first getArg). */
+    ExRequestMap m_cookie;                                            /*!< Parameters from cookie (no connection state). */
+    const ExRequestMap *m_cookies;                                    /*!< Decoded cookies (connection or m_cookie). */
+    ExRouteMatch m_params;                                            /*!< Parameters from path (spans captured by router). */
+    char m_param_buf[EXPRESS_PARAM_BUF_SIZE];                         /*!< NUL terminated copies of path parameters (longer ones go to arena). */
+    int  m_param_buf_len;
+    ExBody m_body;                                                    /*!< Body reader.             */
+    ExCtx<> m_ctx;                                                    /*!< Typed context (see ctx()). */
+    ExRequestUserMap m_user;                                          /*!< Additional parameters (prefer ctx()). */
     njson m_json;                                                     /*!< Parsed JSON document.    */
+    uint32_t m_sent;                                                  /*!< Response bytes sent.     */
+    bool     m_failed;                                                /*!< Error status or send failure. */
+    ExKVTable<4> m_resp_hdr;                                          /*!< Headers added by setHeader() (for respond()). */
+    char    *m_tx;                                                    /*!< Response buffer (NULL = not used yet). */
+    size_t   m_tx_len;
+    bool     m_tx_err;                                                /*!< Send failed (rest of response dropped). */
 #ifdef CONFIG_EXPRESS_USE_AUTH
     ExpressSession *m_session;                                        /*!< Pointer to session data. */
 #endif
 };
 
+/*!
+ * \brief Buffered response writer (one EXPRESS_TX_BUF_SIZE buffer - Express::txBuf()).
+ *   Data is sent only when the buffer is full or at end(): a body that fits in the buffer
+ *   goes out with Content-Length in one write, longer bodies as full size chunks.
+ *   With CONFIG_EXPRESS_USE_GZIP bodies from CONFIG_EXPRESS_GZIP_MIN bytes are gzip
+ *   compressed when Accept-Encoding allows it (see setCompress()).
+ *
+ *   ExResponseStream s(req);
+ *   s << "heap: " << esp_get_free_heap_size() << "\n";
+ *   s.printf("%s: %d\n", name, val);
+ *   s.end();
+ *
+ *   Do not call other send functions of the request until end().
+ */
+class ExResponseStream {
+public:
+    ExResponseStream(ExRequest *rq, const ExResponseProfile &p = ExResponseProfile::txt());
+    ~ExResponseStream() { end(); delete m_z; }
+    ExResponseStream(const ExResponseStream &) = delete;
+    ExResponseStream &operator = (const ExResponseStream &) = delete;
+
+    ExResponseStream &write(const char *d, size_t len);
+    ExResponseStream &write(const char *s) { return write(s, strlen(s)); }
+    int printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+    ExResponseStream &operator << (const char *s) { return s ? write(s, strlen(s)) : *this; }
+    ExResponseStream &operator << (const std::string &s) { return write(s.data(), s.size()); }
+    ExResponseStream &operator << (const ExSpan &s) { return write(s.ptr, s.len); }
+    ExResponseStream &operator << (char c) { return write(&c, 1); }
+    ExResponseStream &operator << (bool v) { return v ? write("true", 4) : write("false", 5); }
+    ExResponseStream &operator << (int v) { return writeInt(v); }
+    ExResponseStream &operator << (long v) { return writeInt(v); }
+    ExResponseStream &operator << (long long v) { return writeInt(v); }
+    ExResponseStream &operator << (unsigned v) { return writeUInt(v); }
+    ExResponseStream &operator << (unsigned long v) { return writeUInt(v); }
+    ExResponseStream &operator << (unsigned long long v) { return writeUInt(v); }
+    ExResponseStream &operator << (double v) { printf("%g", v); return *this; }
+    ExResponseStream &operator << (const njson &v);
+
+    /* Send rest of data and finish response (called by destructor) */
+    esp_err_t end();
+    bool failed() const { return (!m_buf) || (m_rq->m_tx_err); }
+    size_t size() const { return m_total; }
+    /* Allow gzip (default, call before first write - binary or already compressed data) */
+    void setCompress(bool on) { m_compress = on; m_vary = on; }
+
+private:
+    bool startGzip();
+    void put(const char *d, size_t len);
+    static void gzOut(void *ctx, const char *d, size_t len) { ((ExResponseStream *)ctx)->put(d, len); }
+    ExResponseStream &writeInt(long long v);
+    ExResponseStream &writeUInt(unsigned long long v);
+    void flush(bool last);
+
+    ExRequest               *m_rq;
+    const ExResponseProfile *m_p;
+    char                    *m_buf;
+    size_t                   m_len;        /*!< Bytes in buffer (after chunk size reserve). */
+    size_t                   m_total;      /*!< Body bytes written.      */
+    bool                     m_chunked;    /*!< Head sent, chunked mode. */
+    bool                     m_done;
+    bool                     m_compress;   /*!< gzip allowed.            */
+    bool                     m_vary;       /*!< Send Vary: Accept-Encoding. */
+    ExDeflate               *m_z;          /*!< gzip stage (NULL = off). */
+};
+
 #define WS_MAX_FRAME_SIZE (4100)
 
 /*!
@@ -241,10 +638,11 @@ public:
  */
 class WSRequest {
 public:
-    WSRequest(httpd_req_t* rq, Express *e) {
+    WSRequest(httpd_req_t* rq, Express *e, uint8_t *buf) {
         m_req = rq;
         m_server = rq->handle;
         m_e = e;
+        m_buf = buf;
         memset(&m_pkt, 0, sizeof(httpd_ws_frame_t));
         m_pkt.payload = m_buf;
         m_pkt.type = HTTPD_WS_TYPE_TEXT;
@@ -262,7 +660,7 @@ public:
     esp_err_t send(const char* s, int len = 0);
     void send_to_all_clients(const char* buf);
 public:
-    uint8_t           m_buf[WS_MAX_FRAME_SIZE];
+    uint8_t          *m_buf;                  /*!< Frame buffer (WS_MAX_FRAME_SIZE, shared - see Express::m_wsBuf). */
     httpd_ws_frame_t  m_pkt;
     httpd_req_t      *m_req;
     httpd_handle_t    m_server;
@@ -290,10 +688,107 @@ public:
 
 #endif
 
+#include <extyped.hpp>
+
+class ExRouter;
+
+/*!
+ * \brief Mounted router.
+ */
+struct ExpressMount {
+    const char *prefix;
+    ExRouter   *router;
+    size_t      at;                     /*!< Pages registered before mount() (position). */
+};
+
+/*!
+ * \brief Router - set of pages and middlewares (base of Express).
+ *   Can be mounted under prefix in Express (or other router) like e.mount("api/v2", router),
+ *   so modules can register their routes independently.
+ */
+class ExRouter {
+public:
+    ExRouter() { m_frozen = false; }
+
+    /* http methods */
+    void route(const char* path, uint32_t methods, const ExpressMidCB *m, size_t n, ExpressPageCB cb);
+    void route(const char* path, uint32_t methods, ExpressPageCB cb) { route(path, methods, NULL, 0, cb); }
+    void get(const char* path, ExpressPageCB cb)   { route(path, EXPRESS_GET, cb); }
+    void post(const char* path, ExpressPageCB cb)  { route(path, EXPRESS_POST, cb); }
+    void del(const char* path, ExpressPageCB cb)   { route(path, EXPRESS_DELETE, cb); }
+    void patch(const char* path, ExpressPageCB cb) { route(path, EXPRESS_PATCH, cb); }
+    void put(const char* path, ExpressPageCB cb)   { route(path, EXPRESS_PUT, cb); }
+    void all(const char* path, ExpressPageCB cb)   { route(path, EXPRESS_ALL, cb); }
+
+    /* Middleware */
+    void use(const char* path, ExpressMidCB cb);
+    /*!
+     * \brief Max body size of registered page(s) with this path (413 is sent before any middleware runs).
+     */
+    void bodyLimit(const char* path, size_t max);
+    /* Single middleware */
+    void get(const char* path, ExpressMidCB m, ExpressPageCB cb)   { route(path, EXPRESS_GET, &m, 1, cb); }
+    void post(const char* path, ExpressMidCB m, ExpressPageCB cb)  { route(path, EXPRESS_POST, &m, 1, cb); }
+    void del(const char* path, ExpressMidCB m, ExpressPageCB cb)   { route(path, EXPRESS_DELETE, &m, 1, cb); }
+    void patch(const char* path, ExpressMidCB m, ExpressPageCB cb) { route(path, EXPRESS_PATCH, &m, 1, cb); }
+    void put(const char* path, ExpressMidCB m, ExpressPageCB cb)   { route(path, EXPRESS_PUT, &m, 1, cb); }
+    void all(const char* path, ExpressMidCB m, ExpressPageCB cb)   { route(path, EXPRESS_ALL, &m, 1, cb); }
+        
+    /* List of Middlewares like .get("path", {middlewareFunction0, middlewareFunction1}, [] ... );  */
+    void get(const char* path,ExpressMidCBList &l,ExpressPageCB cb)   { route(path, EXPRESS_GET, l.data(), l.size(), cb); }
+    void post(const char* path,ExpressMidCBList &l,ExpressPageCB cb)  { route(path, EXPRESS_POST, l.data(), l.size(), cb); }
+    void del(const char* path,ExpressMidCBList &l,ExpressPageCB cb)   { route(path, EXPRESS_DELETE, l.data(), l.size(), cb); }
+    void patch(const char* path,ExpressMidCBList &l,ExpressPageCB cb) { route(path, EXPRESS_PATCH, l.data(), l.size(), cb); }
+    void put(const char* path,ExpressMidCBList &l,ExpressPageCB cb)   { route(path, EXPRESS_PUT, l.data(), l.size(), cb); }
+    void all(const char* path,ExpressMidCBList &l,ExpressPageCB cb)   { route(path, EXPRESS_ALL, l.data(), l.size(), cb); }
+
+#ifdef EXPRESS_TYPED_ROUTES
+    /* Typed routes like .get<"api/add/:id:int/:val:int">([](ExRequest* req, int id, int val) { ... }); (C++20) */
+    template <ExRoutePath P, typename F> void get(F f)   { route(P.str, EXPRESS_GET, ExTypedRoute<P>::wrap(f)); }
+    template <ExRoutePath P, typename F> void post(F f)  { route(P.str, EXPRESS_POST, ExTypedRoute<P>::wrap(f)); }
+    template <ExRoutePath P, typename F> void del(F f)   { route(P.str, EXPRESS_DELETE, ExTypedRoute<P>::wrap(f)); }
+    template <ExRoutePath P, typename F> void patch(F f) { route(P.str, EXPRESS_PATCH, ExTypedRoute<P>::wrap(f)); }
+    template <ExRoutePath P, typename F> void put(F f)   { route(P.str, EXPRESS_PUT, ExTypedRoute<P>::wrap(f)); }
+    template <ExRoutePath P, typename F> void all(F f)   { route(P.str, EXPRESS_ALL, ExTypedRoute<P>::wrap(f)); }
+#endif
+
+    /*!
+     * \brief Mount router under prefix (router must stay valid until start - pages and
+     *   middlewares are copied into Express then, so a local router may be destroyed afterwards).
+     *   Middlewares of the router are executed only for paths under prefix (after parent middlewares).
+     *   Routes of the router take the place of the mount() call in registration order, so with
+     *   overlapping routes the first registered one still wins (e.g. mount("api", r) before get("api/#")).
+     */
+    void mount(const char* prefix, ExRouter &r);
+
+public:
+    ExpressPgTable         m_pages;
+    ExpressMidMap          m_mid, m_midAll;
+    std::list<ExpressMount> m_mounts;
+    bool                   m_frozen;
+};
+
+/*!
+ * \brief Multipart sink writing firmware into next OTA partition (boot partition is set on success).
+ */
+class ExOtaSink : public ExMultipartSink {
+public:
+    ExOtaSink(Express *e) : m_e(e), m_active(false), m_ok(false) {}
+    bool begin(const ExMultipartPart &p) override;
+    bool write(const char *data, size_t len) override;
+    bool end() override;
+    void abort() override;
+    /* Firmware written and boot partition set - restart after the answer is sent */
+    bool ok() const { return m_ok; }
+private:
+    Express *m_e;
+    bool     m_active, m_ok;
+};
+
 /*!
  * \brief HTTP Server.
  */
-class Express {
+class Express : public ExRouter {
 public:
     /*!
      * \brief Construct a new Express object.
@@ -309,6 +804,20 @@ public:
      */
     void start(int port = 80, uint8_t pr = 0, BaseType_t coreID = tskNO_AFFINITY);
 
+    /*!
+     * \brief Freeze configuration (called by start).
+     *   Precompute middleware chain for every route. Routes and middlewares
+     *   registered after freeze are rejected.
+     */
+    void freeze();
+private:
+    void flatten(ExRouter *r, const std::string &prefix, int parent);
+    void addPages(const ExRouter *r, const ExpressPgTable &t, const std::string &prefix, int s);
+    const char *joinPath(const std::string &prefix, const char *path);
+    const ExResponseProfile *staticProfile(const char *type, const char *headers);
+    ExStaticVariant staticVariant(const char *type, const char *coding, const char *data, int size);
+public:
+
     /*!
      * \brief Check for meta keys ( *, : , #) in path.
      */
@@ -318,48 +827,6 @@ public:
      */
     bool comparePath(const char *a, const char *b) const;
 
-    /* http methods */
-    void get(const char* path, ExpressPageCB cb)   { if (hasMeta(path)) m_lget.push_back({ path, cb }); else m_get.insert({ path, cb }); }
-    void post(const char* path, ExpressPageCB cb)  { if (hasMeta(path)) m_lpost.push_back({ path, cb }); else m_post.insert({ path, cb }); }
-    void del(const char* path, ExpressPageCB cb)   { if (hasMeta(path)) m_ldelete.push_back({ path, cb }); else m_delete.insert({ path, cb }); }
-    void patch(const char* path, ExpressPageCB cb) { if (hasMeta(path)) m_lpatch.push_back({ path, cb }); else m_patch.insert({ path, cb }); }
-    void put(const char* path, ExpressPageCB cb)   { if (hasMeta(path)) m_lput.push_back({ path, cb }); else m_put.insert({ path, cb }); }
-    void all(const char* path, ExpressPageCB cb)   { 
-        if (hasMeta(path)) {
-            /* put to std::list */
-            m_lget.push_back({ path, cb });
-            m_lpost.push_back({ path, cb });
-            m_ldelete.push_back({ path, cb });
-            m_lpatch.push_back({ path, cb });
-            m_lput.push_back({ path, cb });
-        } else {
-            /* put to std::map */
-            m_get.insert({ path, cb }); 
-            m_post.insert({ path, cb });
-            m_delete.insert({ path, cb }); 
-            m_patch.insert({ path, cb });
-            m_put.insert({ path, cb });
-        }
-    }
-
-    /* Middleware */
-    void use(const char* path, ExpressMidCB cb) { if (*path == '\0') m_midAll.push_back({ path, cb }); else m_mid.push_back({ path, cb }); }
-    /* Single middleware */
-    void get(const char* path, ExpressMidCB m, ExpressPageCB cb)   { get(path, [cb, m](ExRequest* r)   { if (m(r)) cb(r); }); }
-    void post(const char* path, ExpressMidCB m, ExpressPageCB cb)  { post(path, [cb, m](ExRequest* r)  { if (m(r)) cb(r); }); }
-    void del(const char* path, ExpressMidCB m, ExpressPageCB cb)   { del(path, [cb, m](ExRequest* r)   { if (m(r)) cb(r); }); }
-    void patch(const char* path, ExpressMidCB m, ExpressPageCB cb) { patch(path, [cb, m](ExRequest* r) { if (m(r)) cb(r); }); }
-    void put(const char* path, ExpressMidCB m, ExpressPageCB cb)   { put(path, [cb, m](ExRequest* r)   { if (m(r)) cb(r); }); }
-    void all(const char* path, ExpressMidCB m, ExpressPageCB cb)   { all(path, [cb, m](ExRequest* r)   { if (m(r)) cb(r); }); }
-        
-    /* List of Middlewares like .get("path", {middlewareFunction0, middlewareFunction1}, [] ... );  */
-    void get(const char* path,ExpressMidCBList &l,ExpressPageCB cb)   { get(path,[cb,l](ExRequest* r)   {for (const auto& f : l) if (!f(r)) return; cb(r); }); }
-    void post(const char* path,ExpressMidCBList &l,ExpressPageCB cb)  { post(path,[cb,l](ExRequest* r)  {for (const auto& f : l) if (!f(r)) return; cb(r); }); }
-    void del(const char* path,ExpressMidCBList &l,ExpressPageCB cb)   { del(path,[cb,l](ExRequest* r)   {for (const auto& f : l) if (!f(r)) return; cb(r); }); }
-    void patch(const char* path,ExpressMidCBList &l,ExpressPageCB cb) { patch(path,[cb,l](ExRequest* r) {for (const auto& f : l) if (!f(r)) return; cb(r); }); }
-    void put(const char* path,ExpressMidCBList &l,ExpressPageCB cb)   { put(path,[cb,l](ExRequest* r)   {for (const auto& f : l) if (!f(r)) return; cb(r); }); }
-    void all(const char* path,ExpressMidCBList &l,ExpressPageCB cb)   { all(path,[cb,l](ExRequest* r)   {for (const auto& f : l) if (!f(r)) return; cb(r); }); }
-
     /* Websocket events */
     void onWS(ExpressWSCB w) { m_wsCB = w; }
     void on(const char* what, ExpressWSON cb) { m_on.insert({ what, cb }); }
@@ -374,6 +841,11 @@ public:
     int ws_connected_clients_count();
 
     void setOnMissing(ExpressMidCB m) {m_onMissing = m;}
+    /* Response buffer (handlers run one at a time on httpd task - shared by all requests) */
+    char *txBuf() {
+        if (!m_txBuf) m_txBuf = (char *)::malloc(EXPRESS_TX_BUF_SIZE);
+        return m_txBuf;
+    }
 
     std::string generateUUID();
     ExpressMidCB getJsonMW();
@@ -398,8 +870,20 @@ public:
      */
     void addStatic(struct www_file_t *);
 
+#ifdef CONFIG_EXPRESS_USE_METRICS
+    /*!
+     * \brief Serve metrics (not registered by default - pages are not protected, add middleware with use()).
+     */
+    void addMetrics(const char *jsonPath = "api/metrics", const char *promPath = "metrics");
+    /*!
+     * \brief Route metrics (sum of all cores) as JSON (api/metrics) or Prometheus text (metrics).
+     */
+    std::string metricsJSON();
+    std::string metricsPrometheus();
+#endif
+
     /* Wrappers */
-    esp_err_t doRQ(httpd_req_t* req, ExpressPgMap* m, ExpressPgList *l);
+    esp_err_t doRQ(httpd_req_t* req);
     esp_err_t doWS(WSRequest* req);
     /* OTA */
     esp_err_t ota_stop(uint32_t abort);
@@ -408,21 +892,36 @@ private:
     /* PM */
     esp_err_t do_pm_lock();
     void      do_pm_unlock();
+    esp_err_t dispatch(ExRequest &rq, int id);
+#ifdef CONFIG_EXPRESS_USE_METRICS
+    void      count(int id, const ExRequest &rq, esp_err_t ret, int64_t us);
+    void      sumStats(size_t id, ExpressRouteStats &t) const;
+#endif
 
 public:
 #if defined(CONFIG_PM_ENABLE)
     esp_pm_lock_handle_t   m_pm_cpu_lock;
     esp_pm_lock_handle_t   m_pm_sleep_lock;
 #endif
-    ExpressPgMap           m_get, m_post, m_delete, m_patch, m_put;
-    ExpressPgList          m_lget, m_lpost, m_ldelete, m_lpatch, m_lput;
-    ExpressMidMap          m_mid, m_midAll;
+    std::vector<ExpressMidRef> m_chain;     /*!< Precomputed middleware chains.            */
+    ExpressChain           m_missChain;     /*!< Middleware chain for not found pages.     */
+#ifdef CONFIG_EXPRESS_USE_METRICS
+    std::vector<ExpressRouteStats> m_stats[portNUM_PROCESSORS]; /*!< Route counters per core (last = not found). */
+#endif
+    std::vector<ExpressScope> m_scopes;     /*!< Middleware scopes (0 = Express).          */
+    std::list<std::string> m_paths;         /*!< Full paths of mounted pages/middlewares.  */
+    std::list<ExpressMidCB> m_mountMid;     /*!< Middlewares of mounted routers (copies).  */
+    ExArena                m_arena;         /*!< Request memory (reused by every request). */
+    uint8_t               *m_wsBuf;         /*!< WS frame buffer (reused by every frame).  */
+    char                  *m_txBuf;         /*!< Response buffer (EXPRESS_TX_BUF_SIZE).    */
+    std::list<ExResponseProfile> m_profiles;/*!< Response heads of static files (shared).  */
+    std::list<ExStaticFile> m_static;       /*!< Static files with encoded variants.       */
     httpd_handle_t         m_server;
     httpd_config_t         m_config;
     ExpressWSCB            m_wsCB;
     ExpressMidCB           m_onMissing;
     /* Wrap handlers */
-    httpd_uri_t            m_h_get, m_h_post, m_h_ws, m_h_delete, m_h_patch, m_h_put;
+    httpd_uri_t            m_h_rq, m_h_ws;
     /* OTA */
     volatile uint32_t      __ota_id, __ota_size, __ota_cnt, __ota_active;
     const esp_partition_t* __ota_update_partition;
@@ -430,7 +929,7 @@ public:
     int64_t                __ota_start_timestamp;
     std::map<const char*, ExpressWSON, ExRequest_cmp_str> m_on;
 #ifdef CONFIG_EXPRESS_USE_AUTH
-    std::map<std::string, ExpressSession *> m_sessions;
+    std::map<std::string, ExpressSession *, std::less<> > m_sessions;
     std::map<std::string, std::string> m_passwd;
 #endif
 };
@@ -0,0 +1,291 @@
+/*
+ * Segment trie router.
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include "exroute.h"
+
+#define EXROUTE_PRIO_META   (0x80000000UL)
+#define EXROUTE_PRIO_NONE   (0xFFFFFFFFUL)
+
+ExRouteTable::ExRouteTable()
+{
+    /* Root node */
+    m_nodes.push_back({ "", 0, ExRouteSegLiteral, -1, -1, -1, EXROUTE_PRIO_NONE });
+}
+
+/*!
+ * \brief Check for meta keys ( *, :, # ) in path.
+ */
+bool ExRouteTable::hasMeta(const char *a)
+{
+    const char *ch = a;
+    while (*ch != '\0') {
+        /* Check for meta characters */
+        if ((*ch == '*') || (*ch == ':') || (*ch == '#')) return true;
+        ch++;
+    }
+    return false;
+}
+
+/*!
+ * \brief Compare path (skip section if * or : characters are detected).
+ */
+bool ExRouteTable::comparePath(const char *a, const char *b, const char *be)
+{
+    if (*a == '\0') return true;
+    while ((*a != '\0') && (b != be)) {
+        if (*a == '#') return true;
+        if ((*a == '*') || (*a == ':')) {
+            /* Skip section */
+            while ((*a != '/') && (*a != '\0')) a++;
+            while ((b != be) && (*b != '/')) b++;
+        }
+        if ((*a == '\0') || (b == be)) break;
+        if (*a != *b) return false;
+        a++;
+        b++;
+    }
+    if ((*a != '\0') || (b != be)) return false;
+    return true;
+}
+
+/*!
+ * \brief Split first segment from path.
+ * \return pointer to the next segment or NULL if this is the last one.
+ */
+const char *ExRouteTable::split(const char *p, ExRouteSeg &g)
+{
+    g.seg = p;
+    g.type = ExRouteSegLiteral;
+    while ((*p != '/') && (*p != '\0')) {
+        if (*p == ':') { g.type = ExRouteSegParam; break; }
+        if (*p == '*') { g.type = ExRouteSegWild; break; }
+        if (*p == '#') { g.type = ExRouteSegTail; break; }
+        p++;
+    }
+    g.seg_len = p - g.seg;
+    g.name = p;
+    g.name_len = 0;
+    if (g.type == ExRouteSegParam) {
+        /* Name ends on next ':' (optional type like :id:int) */
+        g.name = ++p;
+        while ((*p != '/') && (*p != '\0') && (*p != ':')) p++;
+        g.name_len = p - g.name;
+    }
+    /* Skip rest of the segment */
+    while ((*p != '/') && (*p != '\0')) p++;
+    if ((g.type == ExRouteSegTail) || (*p == '\0')) return NULL;
+    return p + 1;
+}
+
+static inline bool exroute_starts(const ExRouteSeg &a, const ExRouteSeg &prefix)
+{
+    return (a.seg_len >= prefix.seg_len) && (memcmp(a.seg, prefix.seg, prefix.seg_len) == 0);
+}
+
+/*!
+ * \brief Check if middleware path matches all uris accepted by route path.
+ */
+ExRouteCover ExRouteTable::covers(const char *mw, const char *route)
+{
+    const char *a = mw, *b = route;
+
+    /* Empty path matches everything */
+    if (*a == '\0') return ExRouteCoverAlways;
+    while (1) {
+        ExRouteSeg x, y;
+        a = split(a, x);
+        b = split(b, y);
+        if (x.type == ExRouteSegTail) {
+            /* Rest of the uri must start with prefix and must not be empty */
+            if (y.type == ExRouteSegLiteral) {
+                if (!exroute_starts(y, x)) return ExRouteCoverNever;
+                if ((y.seg_len > x.seg_len) || (b)) return ExRouteCoverAlways;
+                return ExRouteCoverNever;
+            }
+            return exroute_starts(y, x) ? ExRouteCoverAlways : ExRouteCoverMaybe;
+        }
+        if (y.type == ExRouteSegTail) return ExRouteCoverMaybe;
+        if (x.type == ExRouteSegLiteral) {
+            if (y.type != ExRouteSegLiteral) return ExRouteCoverMaybe;
+            if ((x.seg_len != y.seg_len) || (memcmp(x.seg, y.seg, x.seg_len) != 0)) return ExRouteCoverNever;
+        } else {
+            if (!exroute_starts(y, x)) return (y.type == ExRouteSegLiteral) ? ExRouteCoverNever : ExRouteCoverMaybe;
+            /* Empty last segment never matches */
+            if ((y.type == ExRouteSegLiteral) && (y.seg_len == x.seg_len) && (!a)) return ExRouteCoverNever;
+        }
+        if ((!a) && (!b)) return ExRouteCoverAlways;
+        /* Different number of segments */
+        if ((!a) || (!b)) return ExRouteCoverNever;
+    }
+}
+
+/*!
+ * \brief Find or create child node.
+ */
+int ExRouteTable::addNode(int parent, const char *seg, uint16_t len, uint8_t type)
+{
+    int n, last = -1;
+
+    for (n = m_nodes[parent].child; n >= 0; n = m_nodes[n].next) {
+        const ExRouteNode &x = m_nodes[n];
+        if ((x.type == type) && (x.seg_len == len) && (memcmp(x.seg, seg, len) == 0)) return n;
+        last = n;
+    }
+    n = m_nodes.size();
+    m_nodes.push_back({ seg, len, type, -1, -1, -1, EXROUTE_PRIO_NONE });
+    if (last < 0) m_nodes[parent].child = n; else m_nodes[last].next = n;
+    return n;
+}
+
+/*!
+ * \brief Add route.
+ * \param path    - route path (must stay valid for the table lifetime),
+ * \param methods - accepted methods (bit mask).
+ * \return route id (index in registration order).
+ */
+int ExRouteTable::add(const char *path, uint32_t methods)
+{
+    int id = m_routes.size(), node = 0;
+    uint32_t prio = id;
+    const char *p = path;
+
+    if (hasMeta(path)) prio |= EXROUTE_PRIO_META;
+    m_routes.push_back({ path, methods, prio, -1, (uint16_t)m_names.size(), 0 });
+    if (prio < m_nodes[0].min_prio) m_nodes[0].min_prio = prio;
+
+    /* Split path into segments */
+    do {
+        ExRouteSeg g;
+        p = split(p, g);
+        if (g.type == ExRouteSegParam) {
+            if (m_routes[id].name_count < EXPRESS_MAX_PARAMS) {
+                m_names.push_back({ g.name, g.name_len });
+                m_routes[id].name_count++;
+            }
+        }
+        node = addNode(node, g.seg, g.seg_len, g.type);
+        if (prio < m_nodes[node].min_prio) m_nodes[node].min_prio = prio;
+    } while (p);
+
+    /* Append to the node route list (keep registration order) */
+    if (m_nodes[node].route < 0) {
+        m_nodes[node].route = id;
+    } else {
+        int r = m_nodes[node].route;
+        while (m_routes[r].next >= 0) r = m_routes[r].next;
+        m_routes[r].next = id;
+    }
+    return id;
+}
+
+/*!
+ * \brief Take the best route ending in node (collect methods of the other ones).
+ */
+void ExRouteTable::accept(int node, MatchCtx &c) const
+{
+    for (int r = m_nodes[node].route; r >= 0; r = m_routes[r].next) {
+        const ExRouteEntry &x = m_routes[r];
+        if (!(x.methods & c.method)) {
+            c.allow |= x.methods;
+            continue;
+        }
+        if (x.prio < c.prio) {
+            c.best = r;
+            c.prio = x.prio;
+            c.best_depth = c.depth;
+            memcpy(c.best_val, c.val, c.depth * sizeof(c.val[0]));
+            memcpy(c.best_len, c.val_len, c.depth * sizeof(c.val_len[0]));
+        }
+        /* List is sorted by priority */
+        break;
+    }
+}
+
+/*!
+ * \brief Match segment starting at p against children of node.
+ */
+void ExRouteTable::matchNode(int node, const char *p, MatchCtx &c) const
+{
+    const char *e = p;
+    size_t l;
+
+    while ((e != c.end) && (*e != '/')) e++;
+    l = e - p;
+
+    for (int n = m_nodes[node].child; n >= 0; n = m_nodes[n].next) {
+        const ExRouteNode &x = m_nodes[n];
+        /* Nothing better in this subtree */
+        if (x.min_prio >= c.prio) continue;
+        switch (x.type) {
+            case ExRouteSegLiteral: {
+                if ((l != x.seg_len) || (memcmp(p, x.seg, l) != 0)) continue;
+            } break;
+            case ExRouteSegParam:
+            case ExRouteSegWild: {
+                if ((l < x.seg_len) || (memcmp(p, x.seg, x.seg_len) != 0)) continue;
+                /* Empty last segment never matches */
+                if ((e == c.end) && (l == x.seg_len)) continue;
+            } break;
+            case ExRouteSegTail: {
+                if (((size_t)(c.end - p) <= x.seg_len) || (memcmp(p, x.seg, x.seg_len) != 0)) continue;
+                accept(n, c);
+            } continue;
+        }
+        if (x.type == ExRouteSegParam) {
+            /* Capture value (drop if too many parameters) */
+            uint8_t d = c.depth;
+            if (d < EXPRESS_MAX_PARAMS) {
+                c.val[d] = p + x.seg_len;
+                c.val_len[d] = l - x.seg_len;
+                c.depth++;
+            }
+            if (e == c.end) accept(n, c); else matchNode(n, e + 1, c);
+            c.depth = d;
+        } else {
+            if (e == c.end) accept(n, c); else matchNode(n, e + 1, c);
+        }
+    }
+}
+
+/*!
+ * \brief Find route for uri and capture :parameters in the same walk.
+ * \param uri    - request path (without leading '/' and query string),
+ * \param len    - path length,
+ * \param method - request method (bit mask),
+ * \param m      - match result (may be NULL).
+ * \return route id or -1 if not found.
+ */
+int ExRouteTable::match(const char *uri, size_t len, uint32_t method, ExRouteMatch *m) const
+{
+    MatchCtx c;
+
+    c.end    = uri + len;
+    c.method = method;
+    c.allow  = 0;
+    c.best  = -1;
+    c.prio  = EXROUTE_PRIO_NONE;
+    c.depth = c.best_depth = 0;
+    matchNode(0, uri, c);
+    if (m) {
+        m->route = c.best;
+        m->allow = (c.best < 0) ? c.allow : 0;
+        m->count = 0;
+        if (c.best >= 0) {
+            const ExRouteEntry &r = m_routes[c.best];
+            m->count = r.name_count;
+            for (int i = 0; i < r.name_count; ++i) {
+                m->param[i].name     = m_names[r.name_first + i].name;
+                m->param[i].name_len = m_names[r.name_first + i].len;
+                m->param[i].val      = c.best_val[i];
+                m->param[i].val_len  = c.best_len[i];
+            }
+        }
+    }
+    return c.best;
+}
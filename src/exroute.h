@@ -0,0 +1,199 @@
+/*
+ * Segment trie router.
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __EXROUTE__
+#define __EXROUTE__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <vector>
+
+#ifndef EXPRESS_MAX_PARAMS
+#define EXPRESS_MAX_PARAMS (8)
+#endif
+
+/*!
+ * \brief Path segment type.
+ */
+typedef enum {
+    ExRouteSegLiteral,      /*!< Exact match of whole segment.                 */
+    ExRouteSegParam,        /*!< :name - any segment (value is a parameter).   */
+    ExRouteSegWild,         /*!< *     - any segment.                          */
+    ExRouteSegTail          /*!< #     - rest of the path.                     */
+} ExRouteSegType;
+
+/*!
+ * \brief Relation between middleware path and route path (see ExRouteTable::covers).
+ */
+typedef enum {
+    ExRouteCoverNever,      /*!< No uri matching route matches middleware.     */
+    ExRouteCoverAlways,     /*!< Every uri matching route matches middleware.  */
+    ExRouteCoverMaybe       /*!< Depends on uri (check at runtime).            */
+} ExRouteCover;
+
+/*!
+ * \brief Path segment.
+ */
+struct ExRouteSeg {
+    const char *seg;        /*!< Literal part of the segment.                  */
+    const char *name;       /*!< Parameter name (ExRouteSegParam).             */
+    uint16_t    seg_len;
+    uint16_t    name_len;
+    uint8_t     type;       /*!< ExRouteSegType.                               */
+};
+
+/*!
+ * \brief Trie node (one path segment).
+ */
+struct ExRouteNode {
+    const char *seg;        /*!< Literal part of the segment (not NUL terminated). */
+    uint16_t    seg_len;    /*!< Literal part length.                              */
+    uint8_t     type;       /*!< ExRouteSegType.                                   */
+    int         child;      /*!< First child node (-1 = none).                     */
+    int         next;       /*!< Next sibling node (-1 = none).                    */
+    int         route;      /*!< First route ending in this node (-1 = none).      */
+    uint32_t    min_prio;   /*!< Best route priority in this subtree.              */
+};
+
+/*!
+ * \brief Registered route.
+ */
+struct ExRouteEntry {
+    const char *path;       /*!< Route path as registered.                     */
+    uint32_t    methods;    /*!< Accepted methods (bit mask).                  */
+    uint32_t    prio;       /*!< Priority (lower wins).                        */
+    int         next;       /*!< Next route ending in the same node.           */
+    uint16_t    name_first; /*!< First parameter name in name table.          */
+    uint8_t     name_count; /*!< Number of :parameters in path.                */
+};
+
+/*!
+ * \brief Path parameter name (span in route path).
+ */
+struct ExRouteName {
+    const char *name;
+    uint16_t    len;
+};
+
+/*!
+ * \brief Path parameter captured during match (spans in route path and uri).
+ */
+struct ExRouteParam {
+    const char *name;       /*!< Parameter name (not NUL terminated).          */
+    const char *val;        /*!< Parameter value in uri (not NUL terminated).  */
+    uint16_t    name_len;
+    uint16_t    val_len;
+};
+
+/*!
+ * \brief Match result.
+ */
+struct ExRouteMatch {
+    int          route;                         /*!< Route id or -1.               */
+    uint32_t     allow;                         /*!< Methods accepted by routes matching the path (when route = -1). */
+    uint8_t      count;                         /*!< Number of captured params.    */
+    ExRouteParam param[EXPRESS_MAX_PARAMS];     /*!< Captured params.              */
+
+    /*!
+     * \brief Find captured parameter by name.
+     */
+    ExRouteParam *find(const char *name) {
+        size_t l = strlen(name);
+        for (int i = 0; i < count; ++i) {
+            if ((param[i].name_len == l) && (memcmp(param[i].name, name, l) == 0)) return &param[i];
+        }
+        return NULL;
+    }
+    const ExRouteParam *find(const char *name) const { return const_cast<ExRouteMatch *>(this)->find(name); }
+};
+
+/*!
+ * \brief Route table compiled into a segment trie.
+ *
+ * Paths are split on '/' and every segment becomes a trie node. Literal segments
+ * are compared directly, ':' and '*' accept any segment and '#' accepts the rest
+ * of the path. Lookup is a single walk over the URI. Routes without meta
+ * characters win over routes with meta characters and the first registered
+ * route wins in each group (the same rules as the old map + list lookup).
+ * Every route carries a bit mask of accepted methods, so one table serves
+ * all methods.
+ */
+class ExRouteTable {
+public:
+    ExRouteTable();
+
+    /*!
+     * \brief Add route.
+     * \param path    - route path (must stay valid for the table lifetime),
+     * \param methods - accepted methods (bit mask).
+     * \return route id (index in registration order).
+     */
+    int add(const char *path, uint32_t methods = 0xFFFFFFFFUL);
+
+    /*!
+     * \brief Find route for uri and capture :parameters in the same walk.
+     * \param uri    - request path (without leading '/' and query string, len = path length when not NUL terminated),
+     * \param method - request method (bit mask),
+     * \param m      - match result (may be NULL).
+     * \return route id or -1 if not found.
+     */
+    int match(const char *uri, uint32_t method = 0xFFFFFFFFUL, ExRouteMatch *m = NULL) const { return match(uri, strlen(uri), method, m); }
+    int match(const char *uri, size_t len, uint32_t method, ExRouteMatch *m) const;
+
+    size_t size() const { return m_routes.size(); }
+    const char *path(int id) const { return m_routes[id].path; }
+    uint32_t methods(int id) const { return m_routes[id].methods; }
+
+    /*!
+     * \brief Check for meta keys ( *, :, # ) in path.
+     */
+    static bool hasMeta(const char *a);
+
+    /*!
+     * \brief Compare path (skip section if * or : characters are detected).
+     */
+    static bool comparePath(const char *a, const char *b) { return comparePath(a, b, b + strlen(b)); }
+    static bool comparePath(const char *a, const char *b, const char *be);
+
+    /*!
+     * \brief Split first segment from path.
+     * \return pointer to the next segment or NULL if this is the last one.
+     */
+    static const char *split(const char *p, ExRouteSeg &g);
+
+    /*!
+     * \brief Check if middleware path matches all uris accepted by route path.
+     */
+    static ExRouteCover covers(const char *mw, const char *route);
+
+private:
+    struct MatchCtx {
+        const char *end;
+        uint32_t    method;
+        uint32_t    allow;
+        int         best;
+        uint32_t    prio;
+        uint8_t     depth;                          /*!< Captured values on stack.   */
+        const char *val[EXPRESS_MAX_PARAMS];        /*!< Value stack.                */
+        uint16_t    val_len[EXPRESS_MAX_PARAMS];
+        uint8_t     best_depth;                     /*!< Values of best route.       */
+        const char *best_val[EXPRESS_MAX_PARAMS];
+        uint16_t    best_len[EXPRESS_MAX_PARAMS];
+    };
+    int  addNode(int parent, const char *seg, uint16_t len, uint8_t type);
+    void accept(int node, MatchCtx &c) const;
+    void matchNode(int node, const char *p, MatchCtx &c) const;
+
+    std::vector<ExRouteNode>  m_nodes;
+    std::vector<ExRouteEntry> m_routes;
+    std::vector<ExRouteName>  m_names;
+};
+
+#endif
@@ -0,0 +1,206 @@
+/*
+ * Compile-time typed routes (needs C++20 - class type template parameters).
+ *
+ *   e.get<"api/add/:id:int/:val:int">([](ExRequest* req, int id, int val) { ... });
+ *
+ * Implementation details:
+ *   - Route string is parsed at compile time (number and type of :parameters),
+ *   - Values are decoded by position straight from the uri spans captured by
+ *     the router (no name lookup, no sscanf). Positions count from the end of
+ *     the match, so parameters of a mount prefix (mount("dev/:dev", r)) come first,
+ *   - Unknown type names, duplicate names and handlers not matching the route
+ *     fail to compile,
+ *   - Value not matching the type is answered with 400 Bad Request.
+ *
+ * Parameter by name (misspelled name fails to compile), e.g. in a page middleware:
+ *
+ *   std::optional<int> id = ex_param<"api/add/:id:int/:val:int", "id">(req);
+ *
+ * Parameter types: str (default, std::string_view), int, uint, hex (unsigned).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef EXTYPED_HPP
+#define EXTYPED_HPP
+
+#if defined(__cpp_nontype_template_args) && (__cpp_nontype_template_args >= 201911L)
+#define EXPRESS_TYPED_ROUTES 1
+
+#include <stddef.h>
+#include <limits.h>
+#include <string_view>
+#include <optional>
+#include <tuple>
+#include <utility>
+#include <type_traits>
+
+typedef enum {
+	ExParamStr,
+	ExParamInt,
+	ExParamUint,
+	ExParamHex,
+	ExParamInvalid
+} ExParamType;
+
+/*!
+ * \brief Route path as template parameter.
+ */
+template <size_t N>
+struct ExRoutePath {
+	char str[N] {};
+
+	constexpr ExRoutePath(const char (&s)[N]) { for (size_t i = 0; i < N; ++i) str[i] = s[i]; }
+
+	static constexpr bool eq(const char *a, size_t len, const char *b) {
+		size_t i = 0;
+		for (; i < len; ++i) if (a[i] != b[i]) return false;
+		return b[i] == '\0';
+	}
+	static constexpr bool same(const char *a, size_t al, const char *b, size_t bl) {
+		if (al != bl) return false;
+		for (size_t i = 0; i < al; ++i) if (a[i] != b[i]) return false;
+		return true;
+	}
+
+	/*!
+	 * \brief Walk :parameters (same segment rules as ExRouteTable::split).
+	 * \param idx - parameter index or -1 to count parameters.
+	 * \param name - when not NULL return index of parameter with this name (-1 = none).
+	 * \param ns, nl - name (offset, length) of parameter idx.
+	 */
+	constexpr int walk(int idx, ExParamType *t, const char *name = NULL, size_t *ns = NULL, size_t *nl = NULL) const {
+		int n = 0;
+		size_t p = 0;
+		while (str[p] != '\0') {
+			/* Find first meta in segment */
+			while ((str[p] != '/') && (str[p] != '\0') && (str[p] != ':') && (str[p] != '*') && (str[p] != '#')) p++;
+			if (str[p] == '#') break;
+			if (str[p] == ':') {
+				size_t s, ts;
+				s = ++p;
+				while ((str[p] != '/') && (str[p] != '\0') && (str[p] != ':')) p++;
+				if ((name) && (eq(&str[s], p - s, name))) return n;
+				if ((n == idx) && (ns)) { *ns = s; *nl = p - s; }
+				ts = (str[p] == ':') ? p + 1 : p;
+				while ((str[p] != '/') && (str[p] != '\0')) p++;
+				if (n == idx) {
+					const char *tn = &str[ts];
+					size_t tl = p - ts;
+					if ((tl == 0) || eq(tn, tl, "str")) *t = ExParamStr;
+					else if (eq(tn, tl, "int")) *t = ExParamInt;
+					else if (eq(tn, tl, "uint")) *t = ExParamUint;
+					else if (eq(tn, tl, "hex")) *t = ExParamHex;
+					else *t = ExParamInvalid;
+				}
+				n++;
+			}
+			while ((str[p] != '/') && (str[p] != '\0')) p++;
+			if (str[p] == '/') p++;
+		}
+		return name ? -1 : n;
+	}
+	constexpr int params() const { ExParamType t = ExParamInvalid; return walk(-1, &t); }
+	constexpr ExParamType type(int idx) const { ExParamType t = ExParamInvalid; walk(idx, &t); return t; }
+	constexpr int index(const char *name) const { ExParamType t = ExParamInvalid; return walk(-1, &t, name); }
+	constexpr bool unique() const {
+		ExParamType t = ExParamInvalid;
+		for (int i = 0; i < params(); ++i) {
+			size_t a = 0, al = 0;
+			walk(i, &t, NULL, &a, &al);
+			for (int j = 0; j < i; ++j) {
+				size_t b = 0, bl = 0;
+				walk(j, &t, NULL, &b, &bl);
+				if (same(&str[a], al, &str[b], bl)) return false;
+			}
+		}
+		return true;
+	}
+};
+
+template <ExParamType T> struct ExParamCpp;
+template <> struct ExParamCpp<ExParamStr>  { typedef std::string_view type; };
+template <> struct ExParamCpp<ExParamInt>  { typedef int type; };
+template <> struct ExParamCpp<ExParamUint> { typedef unsigned type; };
+template <> struct ExParamCpp<ExParamHex>  { typedef unsigned type; };
+
+/*!
+ * \brief Decode parameter value from uri span (whole span, range checked - "12abc" is invalid).
+ */
+template <ExParamType T>
+static inline bool ex_param_decode(const ExRouteParam &p, typename ExParamCpp<T>::type &v) {
+	if constexpr (T == ExParamStr) { v = std::string_view(p.val, p.val_len); return true; }
+	else if constexpr (T == ExParamInt) { return ExParse<int>::parse(p.val, p.val_len, &v); }
+	else {
+		uint64_t x;
+		if ((!express_parse_u64(p.val, p.val_len, &x, (T == ExParamUint) ? 10 : 16)) || (x > UINT_MAX)) return false;
+		v = (unsigned)x;
+		return true;
+	}
+}
+
+/*!
+ * \brief Typed route (wraps handler into ExpressPageCB).
+ */
+template <ExRoutePath P>
+struct ExTypedRoute {
+	static constexpr int count = P.params();
+
+	template <size_t I>
+	using arg_t = typename ExParamCpp<P.type(I)>::type;
+
+	template <size_t... I>
+	static constexpr bool valid(std::index_sequence<I...>) { return ((P.type(I) != ExParamInvalid) && ...); }
+
+	template <typename F, size_t... I>
+	static constexpr bool invocable(std::index_sequence<I...>) { return std::is_invocable_v<F &, ExRequest *, arg_t<I>...>; }
+
+	/* Route parameters are the last ones of the match (mount prefix parameters come first) */
+	static const ExRouteParam *own(const ExRequest *req) {
+		return (req->m_params.count >= count) ? req->m_params.param + (req->m_params.count - count) : NULL;
+	}
+
+	template <typename F, size_t... I>
+	static void call(F &f, ExRequest *req, std::index_sequence<I...>) {
+		std::tuple<arg_t<I>...> v;
+		const ExRouteParam *p = own(req);
+		if ((!p) || (!(ex_param_decode<P.type(I)>(p[I], std::get<I>(v)) && ...))) {
+			req->error("400 Bad Request");
+			return;
+		}
+		f(req, std::get<I>(v)...);
+	}
+
+	template <typename F>
+	static ExpressPageCB wrap(F f) {
+		typedef std::make_index_sequence<count> seq;
+		static_assert(count <= EXPRESS_MAX_PARAMS, "Typed route: too many parameters (EXPRESS_MAX_PARAMS)");
+		static_assert(valid(seq{}), "Typed route: unknown parameter type (use str, int, uint or hex)");
+		static_assert(P.unique(), "Typed route: duplicate parameter name");
+		static_assert(invocable<F>(seq{}), "Typed route: handler must accept (ExRequest*, <route parameters>...)");
+		return [f](ExRequest *req) mutable { call(f, req, seq{}); };
+	}
+};
+
+/*!
+ * \brief Typed parameter of route P by name (std::nullopt when missing or not matching the type).
+ */
+template <ExRoutePath P, ExRoutePath Name>
+static inline auto ex_param(const ExRequest *req)
+{
+	constexpr int i = P.index(Name.str);
+	static_assert(i >= 0, "Typed route: no parameter with this name in route");
+	constexpr ExParamType t = (i >= 0) ? P.type(i) : ExParamStr;
+	typename ExParamCpp<t>::type v;
+	const ExRouteParam *p = ExTypedRoute<P>::own(req);
+
+	if ((!p) || (!ex_param_decode<t>(p[i], v))) return std::optional<decltype(v)>();
+	return std::optional<decltype(v)>(v);
+}
+
+#endif
+
+#endif // EXTYPED_HPP
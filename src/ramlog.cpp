@@ -28,6 +28,7 @@
 #include "esp_sntp.h"
 #include <string>
 #include "ramlog.h"
+#include "express.h"
 
 RAMLog *RAMLog::sm_instance = NULL;
 
@@ -54,6 +55,7 @@ void RAMLog::install(bool useSerial, int bufSize)
 	m_size = bufSize;
 	m_buf = (uint8_t *)malloc(bufSize);
 	m_wp = m_rp = 0;
+	m_wcnt = m_rcnt = 0;
 	m_buf[0] = '\0';
 	m_old_fn = esp_log_set_vprintf(ramlog_log_vprintf);
 }
@@ -114,6 +116,7 @@ int RAMLog::write(const char *data, int len)
 			int newp = ramlog_offset(m_wp + need);
 			/* Fixup read pointer if no space left */
 			while (clock_interval(m_wp, newp, m_rp)) {
+				if (m_rp != m_wp) m_rcnt += m_buf[m_rp] + 1;
 				m_rp = getNextPointer(m_rp);
 			}
 			/* Write header */
@@ -123,6 +126,7 @@ int RAMLog::write(const char *data, int len)
 			if (len != l)
 				memcpy(m_buf, data + l, len - l);
 			m_wp = ramlog_offset(m_wp + need);
+			m_wcnt += need;
 		}
 		xSemaphoreGive(m_lock);
 	}
@@ -137,7 +141,7 @@ std::string RAMLog::read()
 {
 	std::string r;
 	/* Locked access */
-	if (xSemaphoreTake(m_lock, (TickType_t)1000) == pdFALSE) return 0;
+	if (xSemaphoreTake(m_lock, (TickType_t)1000) == pdFALSE) return r;
 	int _rp = m_rp;
 	while (_rp != m_wp) {
 		int l, s = (unsigned char)m_buf[_rp];
@@ -152,4 +156,37 @@ std::string RAMLog::read()
 	}
 	xSemaphoreGive(m_lock);
 	return r;
-}
\ No newline at end of file
+}
+
+/*!
+ * \brief Send RAM log to response (line by line, lock is not held while sending).
+ */
+void RAMLog::read(ExResponseStream &s)
+{
+	char line[256];
+	uint32_t pos;
+
+	if (!m_buf) return;
+	/* Locked access */
+	if (xSemaphoreTake(m_lock, (TickType_t)1000) == pdFALSE) return;
+	pos = m_rcnt;
+	for (;;) {
+		int l, len, rp;
+		/* Lines overwritten while sending - continue from the oldest one */
+		if ((uint32_t)(pos - m_rcnt) > (uint32_t)(m_wcnt - m_rcnt)) pos = m_rcnt;
+		if (pos == m_wcnt) break;
+		rp = ramlog_offset(pos);
+		len = m_buf[rp];
+		rp = ramlog_offset(rp + 1);
+		l = MIN(len, m_size - rp);
+		memcpy(line, m_buf + rp, l);
+		if (len != l)
+			memcpy(line + l, m_buf, len - l);
+		pos += len + 1;
+		xSemaphoreGive(m_lock);
+		s.write(line, len);
+		if (s.failed()) return;
+		if (xSemaphoreTake(m_lock, (TickType_t)1000) == pdFALSE) return;
+	}
+	xSemaphoreGive(m_lock);
+}
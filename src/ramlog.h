@@ -23,6 +23,7 @@
 #include <list>
 
 class RAMLog;
+class ExResponseStream;
 
 /*!
  * \brief RAM based circular log.
@@ -61,12 +62,17 @@ public:
      * \brief Read all data from RAM log.
      */
     std::string read();
+    /*!
+     * \brief Send RAM log to response (line by line, lock is not held while sending).
+     */
+    void read(ExResponseStream &s);
 private:
     int getNextPointer(int offset);
 protected:
     RAMLog() {
         m_buf = NULL;
         m_size = m_wp = m_rp = 0;
+        m_wcnt = m_rcnt = 0;
         vSemaphoreCreateBinary(m_lock);
     }
 public:
@@ -75,6 +81,7 @@ public:
     int      m_size;
     int      m_wp;
     int      m_rp;
+    uint32_t m_wcnt, m_rcnt;    /*!< Bytes written/dropped since install (m_wp/m_rp without wrap). */
     bool     m_useSerial;
     vprintf_like_t m_old_fn;
     SemaphoreHandle_t m_lock;